@@ -10,6 +10,18 @@ void Camera::SetOrthographic(float near, float far)
     m_View = glm::lookAt(m_Position, m_Position + m_Orientation, m_Up);
 }
 
+void Camera::SetPosition(const glm::vec3& position)
+{
+    m_Position = position;
+    m_View = glm::lookAt(m_Position, m_Position + m_Orientation, m_Up);
+}
+
+void Camera::Move(const glm::vec3& offset)
+{
+    glm::vec3 right = glm::normalize(glm::cross(m_Orientation, m_Up));
+    SetPosition(m_Position + offset.x * right + offset.y * m_Up + offset.z * m_Orientation);
+}
+
 /////////////////////
 // Input Callbacks //
 /////////////////////
@@ -24,19 +36,26 @@ void KeyCallback(GLFWwindow* window, int key, int scanCode, int action, int mods
 
     if (action == GLFW_PRESS || action == GLFW_REPEAT)
     {
+        float step = camera->GetKeyStep();
         switch (key)
         {
             case GLFW_KEY_UP:
-                std::cout << "UP Pressed" << std::endl;
+                camera->Move(glm::vec3(0.0f, step, 0.0f));
                 break;
             case GLFW_KEY_DOWN:
-                std::cout << "DOWN Pressed" << std::endl;
+                camera->Move(glm::vec3(0.0f, -step, 0.0f));
                 break;
             case GLFW_KEY_LEFT:
-                std::cout << "LEFT Pressed" << std::endl;
+                camera->Move(glm::vec3(-step, 0.0f, 0.0f));
                 break;
             case GLFW_KEY_RIGHT:
-                std::cout << "RIGHT Pressed" << std::endl;
+                camera->Move(glm::vec3(step, 0.0f, 0.0f));
+                break;
+            case GLFW_KEY_W:
+                camera->Move(glm::vec3(0.0f, 0.0f, step));
+                break;
+            case GLFW_KEY_S:
+                camera->Move(glm::vec3(0.0f, 0.0f, -step));
                 break;
             default:
                 break;
@@ -69,13 +88,15 @@ void CursorPosCallback(GLFWwindow* window, double currMouseX, double currMouseY)
     camera->m_OldMouseX = currMouseX;
     camera->m_OldMouseY = currMouseY;
 
+    // drag the scene: the camera moves against the cursor
+    float step = camera->GetDragStep();
     if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS)
     {
-        std::cout << "MOUSE LEFT Motion" << std::endl;
+        camera->Move(glm::vec3(camera->m_NewMouseX * step, -camera->m_NewMouseY * step, 0.0f));
     }
     else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS)
     {
-        std::cout << "MOUSE RIGHT Motion" << std::endl;
+        camera->Move(glm::vec3(0.0f, 0.0f, camera->m_NewMouseY * step));
     }
 }
 
@@ -87,7 +108,7 @@ void ScrollCallback(GLFWwindow* window, double scrollOffsetX, double scrollOffse
         return;
     }
 
-    std::cout << "SCROLL Motion" << std::endl;
+    camera->Move(glm::vec3(0.0f, 0.0f, scrollOffsetY * camera->GetScrollStep()));
 }
 
 void Camera::EnableInputs(GLFWwindow* window)
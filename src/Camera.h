@@ -36,6 +36,11 @@ class Camera
         float m_Right = 1.0f;
         float m_Bottom = -1.0f; 
         float m_Top = 1.0f;
+
+        // Movement per key press, per dragged pixel and per scroll step
+        float m_KeyStep = 0.05f;
+        float m_DragStep = 0.005f;
+        float m_ScrollStep = 0.1f;
     public:
         // Prevent the camera from jumping around when first clicking left click
         double m_OldMouseX = 0.0;
@@ -49,9 +54,19 @@ class Camera
         // Update Projection matrix for Orthographic mode
         void SetOrthographic(float near, float far);
 
-        // Handle camera inputs
+        // Handle camera inputs: the arrow keys and a left drag move the camera sideways and up/down,
+        // W/S, a right drag and the scroll wheel move it along its orientation
         void EnableInputs(GLFWwindow* window);
 
+        void SetPosition(const glm::vec3& position);
+        // offset.x moves right, offset.y up and offset.z forward, relative to the orientation
+        void Move(const glm::vec3& offset);
+
+        inline glm::vec3 GetPosition() const { return m_Position; }
+        inline float GetKeyStep() const { return m_KeyStep; }
+        inline float GetDragStep() const { return m_DragStep; }
+        inline float GetScrollStep() const { return m_ScrollStep; }
+
         inline glm::mat4 GetViewMatrix() const { return m_View; }
         inline glm::mat4 GetProjectionMatrix() const { return m_Projection; }
 };
\ No newline at end of file
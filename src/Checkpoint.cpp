@@ -0,0 +1,175 @@
+#include <Checkpoint.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    const char s_Magic[4] = { 'R', 'T', 'C', 'K' };
+    const uint32_t s_Version = 1;
+
+    template <typename T>
+    void WriteValue(std::ofstream& file, T value)
+    {
+        file.write((const char*)&value, sizeof(T));
+    }
+
+    template <typename T>
+    bool ReadValue(std::ifstream& file, T& value)
+    {
+        return (bool)file.read((char*)&value, sizeof(T));
+    }
+
+    void WriteBytes(std::ofstream& file, const std::vector<unsigned char>& bytes)
+    {
+        WriteValue<uint32_t>(file, (uint32_t)bytes.size());
+        file.write((const char*)bytes.data(), bytes.size());
+    }
+
+    bool ReadBytes(std::ifstream& file, std::vector<unsigned char>& bytes)
+    {
+        uint32_t size;
+        if (!ReadValue(file, size) || size > (1u << 30))
+            return false;
+        bytes.resize(size);
+        return (bool)file.read((char*)bytes.data(), size);
+    }
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+Checkpoint::Checkpoint(const std::string& filepath, uint64_t fingerprint, double intervalSeconds)
+    : m_Filepath(filepath), m_Fingerprint(fingerprint), m_IntervalSeconds(intervalSeconds),
+      m_LastWrite(std::chrono::steady_clock::now())
+{
+}
+
+bool Checkpoint::Load()
+{
+    std::ifstream file(m_Filepath, std::ios::binary);
+    if (!file)
+        return false;
+
+    char magic[4];
+    uint32_t version, count;
+    uint64_t fingerprint;
+    if (!file.read(magic, 4) || !std::equal(magic, magic + 4, s_Magic) ||
+        !ReadValue(file, version) || version != s_Version || !ReadValue(file, fingerprint))
+    {
+        std::cerr << "Warning: " << m_Filepath << " is not a render checkpoint, starting over" << std::endl;
+        return false;
+    }
+    if (fingerprint != m_Fingerprint)
+    {
+        std::cerr << "Warning: " << m_Filepath << " belongs to another scene or settings, starting over" << std::endl;
+        return false;
+    }
+
+    std::map<int, TileRecord> tiles;
+    if (!ReadValue(file, count))
+        return false;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int32_t tile, phase;
+        int64_t samples;
+        TileRecord record;
+        if (!ReadValue(file, tile) || !ReadValue(file, phase) || !ReadValue(file, samples) ||
+            !ReadBytes(file, record.Traced) || !ReadBytes(file, record.Final))
+        {
+            std::cerr << "Warning: " << m_Filepath << " is truncated, starting over" << std::endl;
+            return false;
+        }
+        record.Phase = phase;
+        record.Samples = samples;
+        tiles[tile] = record;
+    }
+
+    std::lock_guard<std::mutex> guard(m_Lock);
+    m_Tiles.swap(tiles);
+    return true;
+}
+
+void Checkpoint::Complete(int tile, const TileRecord& record)
+{
+    std::lock_guard<std::mutex> guard(m_Lock);
+    m_Tiles[tile] = record;
+
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - m_LastWrite).count() >= m_IntervalSeconds)
+    {
+        WriteLocked();
+        m_LastWrite = now;
+    }
+}
+
+bool Checkpoint::Find(int tile, TileRecord& record) const
+{
+    std::lock_guard<std::mutex> guard(m_Lock);
+    auto found = m_Tiles.find(tile);
+    if (found == m_Tiles.end())
+        return false;
+    record = found->second;
+    return true;
+}
+
+bool Checkpoint::Write() const
+{
+    std::lock_guard<std::mutex> guard(m_Lock);
+    return WriteLocked();
+}
+
+bool Checkpoint::WriteLocked() const
+{
+    std::string temporary = m_Filepath + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cerr << "Warning: cannot write checkpoint " << temporary << std::endl;
+            return false;
+        }
+        file.write(s_Magic, 4);
+        WriteValue<uint32_t>(file, s_Version);
+        WriteValue<uint64_t>(file, m_Fingerprint);
+        WriteValue<uint32_t>(file, (uint32_t)m_Tiles.size());
+        for (const auto& entry : m_Tiles)
+        {
+            WriteValue<int32_t>(file, entry.first);
+            WriteValue<int32_t>(file, entry.second.Phase);
+            WriteValue<int64_t>(file, entry.second.Samples);
+            WriteBytes(file, entry.second.Traced);
+            WriteBytes(file, entry.second.Final);
+        }
+        file.flush();
+        if (!file)
+            return false;
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    // rename() does not replace an existing file on Windows
+    std::remove(m_Filepath.c_str());
+#endif
+    return std::rename(temporary.c_str(), m_Filepath.c_str()) == 0;
+}
+
+void Checkpoint::Remove() const
+{
+    std::remove(m_Filepath.c_str());
+}
+
+int Checkpoint::GetTileCount() const
+{
+    std::lock_guard<std::mutex> guard(m_Lock);
+    return (int)m_Tiles.size();
+}
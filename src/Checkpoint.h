@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 64-bit FNV-1a hash, chainable through hash
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+
+// State of one finished tile
+struct TileRecord
+{
+    int Phase = 0;                       // 1 = traced, 2 = traced and anti-aliased
+    long long Samples = 0;               // anti-aliasing samples spent on the tile
+    std::vector<unsigned char> Traced;   // RGBA after the first sample
+    std::vector<unsigned char> Final;    // RGBA after anti-aliasing (phase 2 only)
+};
+
+// Finished tiles of a render, persisted so an interrupted render can resume.
+// Workers report tiles concurrently; the whole file is rewritten at most once per interval
+// through a temporary file and a rename, so a crash never leaves a half-written checkpoint.
+class Checkpoint
+{
+    private:
+        std::string m_Filepath;
+        uint64_t m_Fingerprint;
+        double m_IntervalSeconds;
+        std::chrono::steady_clock::time_point m_LastWrite;
+        std::map<int, TileRecord> m_Tiles;
+        mutable std::mutex m_Lock;
+
+        bool WriteLocked() const;
+    public:
+        // fingerprint identifies the scene and every setting that affects pixels
+        Checkpoint(const std::string& filepath, uint64_t fingerprint, double intervalSeconds);
+
+        // Reads the checkpoint file; false if it is missing, corrupt or from another render
+        bool Load();
+
+        // Stores a finished tile and writes the file if the interval has elapsed
+        void Complete(int tile, const TileRecord& record);
+        bool Find(int tile, TileRecord& record) const;
+
+        bool Write() const;
+        void Remove() const;
+
+        inline const std::string& GetFilepath() const { return m_Filepath; }
+        int GetTileCount() const;
+};
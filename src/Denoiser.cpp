@@ -0,0 +1,153 @@
+#include <Denoiser.h>
+
+#include <cmath>
+#include <thread>
+
+namespace
+{
+    const float s_Kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+    const float s_AlbedoEpsilon = 0.01f;
+}
+
+void GuideBuffers::Resize(int pixelCount)
+{
+    Normal.assign(pixelCount, glm::vec3(0.0f));
+    Depth.assign(pixelCount, 0.0f);
+    ObjectId.assign(pixelCount, -1);
+    Albedo.assign(pixelCount, glm::vec3(0.0f));
+}
+
+Denoiser::Denoiser(int passes, int threads)
+    : m_Passes(passes), m_Threads(glm::max(1, threads))
+{
+}
+
+void Denoiser::FilterRows(int firstRow, int lastRow, int firstColumn, int lastColumn, int step, int width, int height,
+                          const GuideBuffers& guides, const std::vector<float>* in, std::vector<float>* out) const
+{
+    float colorScale = 1.0f / (m_ColorSigma * m_ColorSigma);
+    float depthScale = 1.0f / m_DepthSigma;
+    float albedoScale = 1.0f / (m_AlbedoSigma * m_AlbedoSigma);
+
+    for (int y = firstRow; y < lastRow; y++)
+    {
+        for (int x = firstColumn; x < lastColumn; x++)
+        {
+            int p = x + y * width;
+            float r = in[0][p], g = in[1][p], b = in[2][p];
+            glm::vec3 normal = guides.Normal[p];
+            float depth = guides.Depth[p];
+            int id = guides.ObjectId[p];
+            glm::vec3 albedo = guides.Albedo[p];
+
+            float sumR = 0.0f, sumG = 0.0f, sumB = 0.0f, weightSum = 0.0f;
+            for (int ky = 0; ky < 5; ky++)
+            {
+                int qy = y + (ky - 2) * step;
+                if (qy < 0 || qy >= height)
+                    continue;
+                for (int kx = 0; kx < 5; kx++)
+                {
+                    int qx = x + (kx - 2) * step;
+                    if (qx < 0 || qx >= width)
+                        continue;
+                    int q = qx + qy * width;
+                    if (guides.ObjectId[q] != id)
+                        continue;
+
+                    float dr = in[0][q] - r, dg = in[1][q] - g, db = in[2][q] - b;
+                    glm::vec3 da = guides.Albedo[q] - albedo;
+                    float cosine = glm::max(0.0f, glm::dot(guides.Normal[q], normal));
+                    float exponent = (dr * dr + dg * dg + db * db) * colorScale
+                                   + std::fabs(guides.Depth[q] - depth) * depthScale
+                                   + glm::dot(da, da) * albedoScale;
+                    float weight = s_Kernel[kx] * s_Kernel[ky] * std::exp(-exponent);
+                    if (id >= 0)
+                        weight *= std::pow(cosine, m_NormalPower);
+
+                    sumR += in[0][q] * weight;
+                    sumG += in[1][q] * weight;
+                    sumB += in[2][q] * weight;
+                    weightSum += weight;
+                }
+            }
+
+            // the centre tap always contributes, so weightSum > 0
+            out[0][p] = sumR / weightSum;
+            out[1][p] = sumG / weightSum;
+            out[2][p] = sumB / weightSum;
+        }
+    }
+}
+
+void Denoiser::Denoise(unsigned char* image, int width, int height, const GuideBuffers& guides) const
+{
+    Denoise(image, width, height, guides, 0, 0, width, height);
+}
+
+void Denoiser::Denoise(unsigned char* image, int width, int height, const GuideBuffers& guides,
+                       int x0, int y0, int x1, int y1) const
+{
+    if (m_Passes <= 0 || x0 >= x1 || y0 >= y1)
+        return;
+
+    // planar demodulated lighting, so each pass streams through contiguous floats
+    int pixelCount = width * height;
+    std::vector<float> planes[2][3];
+    for (int c = 0; c < 3; c++)
+    {
+        planes[0][c].resize(pixelCount);
+        planes[1][c].resize(pixelCount);
+        for (int p = 0; p < pixelCount; p++)
+            planes[0][c][p] = image[p * 4 + c] / 255.0f / glm::max(guides.Albedo[p][c], s_AlbedoEpsilon);
+    }
+
+    int current = 0;
+    for (int pass = 0; pass < m_Passes; pass++)
+    {
+        int step = 1 << pass;
+        int rows = y1 - y0;
+        int threads = glm::min(m_Threads, rows);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++)
+        {
+            int firstRow = y0 + rows * t / threads;
+            int lastRow = y0 + rows * (t + 1) / threads;
+            workers.emplace_back(&Denoiser::FilterRows, this, firstRow, lastRow, x0, x1, step, width, height,
+                                 std::cref(guides), planes[current], planes[1 - current]);
+        }
+        for (std::thread& worker : workers)
+            worker.join();
+        current = 1 - current;
+    }
+
+    for (int c = 0; c < 3; c++)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = x0; x < x1; x++)
+            {
+                int p = x + y * width;
+                float value = planes[current][c][p] * glm::max(guides.Albedo[p][c], s_AlbedoEpsilon);
+                image[p * 4 + c] = (unsigned char)(glm::clamp(value, 0.0f, 1.0f) * 255 + 0.5f);
+            }
+        }
+    }
+}
+
+double Denoiser::PSNR(const unsigned char* image, const unsigned char* reference, int pixelCount, int referenceComponents)
+{
+    double squaredError = 0.0;
+    for (int p = 0; p < pixelCount; p++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            double difference = (double)image[p * 4 + c] - reference[p * referenceComponents + c];
+            squaredError += difference * difference;
+        }
+    }
+    double mse = squaredError / (pixelCount * 3.0);
+    if (mse == 0.0)
+        return INFINITY;
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
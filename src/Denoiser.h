@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Auxiliary buffers captured at the primary hit of every pixel
+struct GuideBuffers
+{
+    std::vector<glm::vec3> Normal;
+    std::vector<float> Depth;      // distance from the eye, 0 for background
+    std::vector<int> ObjectId;     // -1 for background
+    std::vector<glm::vec3> Albedo; // surface colour, 1 where the colour comes from secondary rays
+
+    void Resize(int pixelCount);
+};
+
+// Edge-avoiding a-trous wavelet filter. Each pass blurs with a 5x5 B3-spline kernel whose
+// taps are spread 2^pass pixels apart and weighted down across colour, normal, depth,
+// object and albedo edges. Lighting is filtered with the albedo divided out, so surface
+// patterns stay sharp.
+class Denoiser
+{
+    private:
+        int m_Passes;
+        int m_Threads;
+        float m_ColorSigma = 0.1f;
+        float m_NormalPower = 64.0f;
+        float m_DepthSigma = 0.1f;
+        float m_AlbedoSigma = 0.1f;
+
+        void FilterRows(int firstRow, int lastRow, int firstColumn, int lastColumn, int step, int width, int height,
+                        const GuideBuffers& guides, const std::vector<float>* in, std::vector<float>* out) const;
+    public:
+        Denoiser(int passes, int threads);
+
+        // Filters width x height RGBA8 pixels in place; alpha is left untouched
+        void Denoise(unsigned char* image, int width, int height, const GuideBuffers& guides) const;
+
+        // Filters only the window [x0, x1) x [y0, y1). Pixels closer to its border than the
+        // filter's reach (2 * (2^passes - 1)) read unfiltered values from outside it.
+        void Denoise(unsigned char* image, int width, int height, const GuideBuffers& guides,
+                     int x0, int y0, int x1, int y1) const;
+
+        inline void SetColorSigma(float sigma) { m_ColorSigma = sigma; }
+        inline int GetPasses() const { return m_Passes; }
+
+        // Peak signal-to-noise ratio in dB between two RGB(A)8 images, alpha is ignored
+        static double PSNR(const unsigned char* image, const unsigned char* reference, int pixelCount, int referenceComponents = 4);
+};
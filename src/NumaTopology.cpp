@@ -0,0 +1,90 @@
+#include <NumaTopology.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+    const std::string s_NodeDirectory = "/sys/devices/system/node/";
+
+    bool ReadLine(const std::string& filepath, std::string& line)
+    {
+        std::ifstream file(filepath);
+        return file && std::getline(file, line) && !line.empty();
+    }
+}
+
+NumaTopology::NumaTopology()
+{
+    std::string line;
+    if (ReadLine(s_NodeDirectory + "online", line))
+    {
+        for (int node : ParseList(line))
+        {
+            std::string cpus;
+            if (ReadLine(s_NodeDirectory + "node" + std::to_string(node) + "/cpulist", cpus) && !ParseList(cpus).empty())
+                m_NodeCpus.push_back(ParseList(cpus));
+        }
+    }
+
+    // memory-only nodes are skipped above; with no usable node fall back to one node
+    if (m_NodeCpus.empty())
+    {
+        int cpus = std::max(1, (int)std::thread::hardware_concurrency());
+        m_NodeCpus.emplace_back();
+        for (int cpu = 0; cpu < cpus; cpu++)
+            m_NodeCpus[0].push_back(cpu);
+    }
+}
+
+const NumaTopology& NumaTopology::System()
+{
+    static const NumaTopology topology;
+    return topology;
+}
+
+bool NumaTopology::PinCurrentThread(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+std::vector<int> NumaTopology::ParseList(const std::string& list)
+{
+    std::vector<int> values;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ','))
+    {
+        int first, last;
+        char dash;
+        std::stringstream rangeStream(range);
+        if (!(rangeStream >> first))
+            continue;
+        if (rangeStream >> dash >> last && dash == '-')
+        {
+            for (int value = first; value <= last; value++)
+                values.push_back(value);
+        }
+        else
+            values.push_back(first);
+    }
+    return values;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// NUMA nodes of the machine and the CPUs that belong to each, read from
+// /sys/devices/system/node. Elsewhere, or without sysfs, all CPUs form a single node.
+class NumaTopology
+{
+    private:
+        std::vector<std::vector<int>> m_NodeCpus;
+
+        NumaTopology();
+    public:
+        // Detected once, on first use
+        static const NumaTopology& System();
+
+        inline int GetNodeCount() const { return (int)m_NodeCpus.size(); }
+        inline const std::vector<int>& GetCpus(int node) const { return m_NodeCpus[node]; }
+
+        // Restricts the calling thread to the given CPUs; false if that is not supported
+        static bool PinCurrentThread(const std::vector<int>& cpus);
+
+        // Parses a sysfs CPU or node list such as "0-3,8,10-11"
+        static std::vector<int> ParseList(const std::string& list);
+};
@@ -0,0 +1,527 @@
+#include <PngWriter.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+    const unsigned char s_Signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    const size_t s_StripBytes = 1 << 18;    // filtered bytes per strip, fewer if the threads need more strips
+    const int s_WindowSize = 1 << 15;
+    const int s_HashBits = 15;
+    const int s_MinMatch = 3;
+    const int s_MaxMatch = 258;
+    const uint32_t s_AdlerBase = 65521;
+
+    const uint16_t s_LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                        67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const uint8_t s_LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const uint16_t s_DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                                          1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const uint8_t s_DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+                                          11, 11, 12, 12, 13, 13 };
+
+    // How hard a compressed strip searches for matches
+    struct Effort
+    {
+        int MaxChain;          // candidates tried per position
+        bool InsertMatched;    // also index the positions inside a match
+    };
+
+    uint32_t ReverseBits(uint32_t code, int bits)
+    {
+        uint32_t reversed = 0;
+        for (int bit = 0; bit < bits; bit++)
+            reversed |= ((code >> bit) & 1) << (bits - 1 - bit);
+        return reversed;
+    }
+
+    // Fixed Huffman codes (RFC 1951, 3.2.6), bit-reversed since deflate packs codes from the top bit
+    // into a stream that is read from the low bit, and the CRC-32 table of PNG chunks
+    struct Tables
+    {
+        uint16_t LiteralCode[288];
+        uint8_t LiteralBits[288];
+        uint16_t DistanceCode[30];
+        uint8_t LengthSymbol[s_MaxMatch + 1];
+        uint8_t DistanceSymbol[s_WindowSize + 1];
+        uint32_t Crc[256];
+
+        Tables()
+        {
+            for (int symbol = 0; symbol < 288; symbol++)
+            {
+                uint32_t code;
+                int bits;
+                if (symbol < 144)
+                    code = 0x30 + symbol, bits = 8;
+                else if (symbol < 256)
+                    code = 0x190 + symbol - 144, bits = 9;
+                else if (symbol < 280)
+                    code = symbol - 256, bits = 7;
+                else
+                    code = 0xC0 + symbol - 280, bits = 8;
+                LiteralCode[symbol] = (uint16_t)ReverseBits(code, bits);
+                LiteralBits[symbol] = (uint8_t)bits;
+            }
+            for (int symbol = 0; symbol < 30; symbol++)
+                DistanceCode[symbol] = (uint16_t)ReverseBits(symbol, 5);
+
+            for (int symbol = 0; symbol < 29; symbol++)
+            {
+                int last = symbol == 28 ? s_MaxMatch : s_LengthBase[symbol] + (1 << s_LengthExtra[symbol]) - 1;
+                for (int length = s_LengthBase[symbol]; length <= last; length++)
+                    LengthSymbol[length] = (uint8_t)symbol;
+            }
+            // length 258 also falls in symbol 27's range; it has a code of its own
+            LengthSymbol[s_MaxMatch] = 28;
+            for (int symbol = 0; symbol < 30; symbol++)
+            {
+                int last = std::min(s_WindowSize, s_DistanceBase[symbol] + (1 << s_DistanceExtra[symbol]) - 1);
+                for (int distance = s_DistanceBase[symbol]; distance <= last; distance++)
+                    DistanceSymbol[distance] = (uint8_t)symbol;
+            }
+
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int bit = 0; bit < 8; bit++)
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                Crc[n] = c;
+            }
+        }
+    };
+
+    const Tables& GetTables()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+    {
+        const Tables& tables = GetTables();
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+            crc = tables.Crc[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    uint32_t Adler32(const unsigned char* data, size_t size)
+    {
+        uint32_t a = 1, b = 0;
+        while (size > 0)
+        {
+            // 5552 bytes is the longest run whose sums cannot overflow 32 bits before the modulo
+            size_t run = std::min(size, (size_t)5552);
+            for (size_t i = 0; i < run; i++)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= s_AdlerBase;
+            b %= s_AdlerBase;
+            data += run;
+            size -= run;
+        }
+        return b << 16 | a;
+    }
+
+    // Adler-32 of the concatenation of two blocks, from their checksums and the second one's size
+    uint32_t CombineAdler32(uint32_t first, uint32_t second, size_t secondSize)
+    {
+        uint64_t remainder = secondSize % s_AdlerBase;
+        uint64_t a = first & 0xFFFF;
+        uint64_t b = (remainder * a) % s_AdlerBase;
+        a += (second & 0xFFFF) + s_AdlerBase - 1;
+        b += (first >> 16) + (second >> 16) + s_AdlerBase - remainder;
+        a %= s_AdlerBase;
+        b %= s_AdlerBase;
+        return (uint32_t)(b << 16 | a);
+    }
+
+    void PutBigEndian(std::vector<unsigned char>& out, uint32_t value)
+    {
+        out.push_back((unsigned char)(value >> 24));
+        out.push_back((unsigned char)(value >> 16));
+        out.push_back((unsigned char)(value >> 8));
+        out.push_back((unsigned char)value);
+    }
+
+    void SetBigEndian(unsigned char* out, uint32_t value)
+    {
+        out[0] = (unsigned char)(value >> 24);
+        out[1] = (unsigned char)(value >> 16);
+        out[2] = (unsigned char)(value >> 8);
+        out[3] = (unsigned char)value;
+    }
+
+    // Starts a chunk with a length to be filled in by EndChunk
+    size_t BeginChunk(std::vector<unsigned char>& png, const char* type)
+    {
+        size_t start = png.size();
+        PutBigEndian(png, 0);
+        png.insert(png.end(), type, type + 4);
+        return start;
+    }
+
+    void EndChunk(std::vector<unsigned char>& png, size_t start)
+    {
+        SetBigEndian(&png[start], (uint32_t)(png.size() - start - 8));
+        PutBigEndian(png, Crc32(&png[start + 4], png.size() - start - 4));
+    }
+
+    // Deflate bit stream, least significant bit first
+    class BitWriter
+    {
+        private:
+            std::vector<unsigned char>& m_Out;
+            uint64_t m_Bits = 0;
+            int m_Count = 0;
+        public:
+            BitWriter(std::vector<unsigned char>& out)
+                : m_Out(out) {};
+
+            inline void Put(uint32_t value, int bits)
+            {
+                m_Bits |= (uint64_t)value << m_Count;
+                m_Count += bits;
+                while (m_Count >= 8)
+                {
+                    m_Out.push_back((unsigned char)m_Bits);
+                    m_Bits >>= 8;
+                    m_Count -= 8;
+                }
+            }
+
+            // Pads with zero bits to the next byte
+            void Align()
+            {
+                if (m_Count > 0)
+                    Put(0, 8 - m_Count);
+            }
+    };
+
+    int Paeth(int left, int above, int aboveLeft)
+    {
+        int estimate = left + above - aboveLeft;
+        int toLeft = std::abs(estimate - left), toAbove = std::abs(estimate - above), toAboveLeft = std::abs(estimate - aboveLeft);
+        if (toLeft <= toAbove && toLeft <= toAboveLeft)
+            return left;
+        return toAbove <= toAboveLeft ? above : aboveLeft;
+    }
+
+    // Filters one row into out, filter type first. Every filter is tried and the one with the
+    // smallest sum of absolute (signed) residuals is kept, the usual heuristic; store mode does not
+    // filter. above is nullptr for the first row, scratch holds rowBytes bytes.
+    void FilterRow(const unsigned char* row, const unsigned char* above, int rowBytes, int bpp, bool choose,
+                   unsigned char* scratch, unsigned char* out)
+    {
+        out[0] = 0;
+        std::copy(row, row + rowBytes, out + 1);
+        if (!choose)
+            return;
+
+        long bestCost = 0;
+        for (int i = 0; i < rowBytes; i++)
+            bestCost += std::abs((int)(signed char)row[i]);
+        for (int filter = 1; filter < 5; filter++)
+        {
+            long cost = 0;
+            for (int i = 0; i < rowBytes; i++)
+            {
+                int left = i >= bpp ? row[i - bpp] : 0;
+                int up = above ? above[i] : 0;
+                int upLeft = above && i >= bpp ? above[i - bpp] : 0;
+                int predicted = filter == 1 ? left : filter == 2 ? up : filter == 3 ? (left + up) / 2 : Paeth(left, up, upLeft);
+                scratch[i] = (unsigned char)(row[i] - predicted);
+                cost += std::abs((int)(signed char)scratch[i]);
+            }
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                out[0] = (unsigned char)filter;
+                std::copy(scratch, scratch + rowBytes, out + 1);
+            }
+        }
+    }
+
+    uint32_t Hash(const unsigned char* data)
+    {
+        uint32_t bytes = (uint32_t)data[0] << 16 | (uint32_t)data[1] << 8 | data[2];
+        return (bytes * 2654435761u) >> (32 - s_HashBits);
+    }
+
+    // Deflates one strip into out as a single fixed-Huffman block, greedy LZ77 over the strip only.
+    // A strip that is not the last one ends with an empty stored block (a sync flush), which
+    // leaves the stream on a byte boundary without ending it.
+    void DeflateStrip(const unsigned char* data, size_t size, const Effort& effort, bool last, std::vector<unsigned char>& out)
+    {
+        const Tables& tables = GetTables();
+        std::vector<int> head(1 << s_HashBits, -1);
+        std::vector<int> previous(s_WindowSize, -1);
+        auto insert = [&](size_t position) {
+            uint32_t hash = Hash(data + position);
+            previous[position & (s_WindowSize - 1)] = head[hash];
+            head[hash] = (int)position;
+        };
+
+        BitWriter bits(out);
+        bits.Put(last ? 1 : 0, 1);
+        bits.Put(1, 2);
+        size_t i = 0;
+        while (i < size)
+        {
+            int bestLength = 0, bestDistance = 0;
+            if (i + s_MinMatch <= size)
+            {
+                int limit = (int)std::min((size_t)s_MaxMatch, size - i);
+                int candidate = head[Hash(data + i)];
+                for (int chain = 0; chain < effort.MaxChain && candidate >= 0 && (int)i - candidate <= s_WindowSize; chain++)
+                {
+                    // a longer match must at least agree at the current best length
+                    if (data[candidate + bestLength] == data[i + bestLength])
+                    {
+                        int length = 0;
+                        while (length < limit && data[candidate + length] == data[i + length])
+                            length++;
+                        if (length > bestLength)
+                        {
+                            bestLength = length;
+                            bestDistance = (int)i - candidate;
+                            if (length == limit)
+                                break;
+                        }
+                    }
+                    candidate = previous[candidate & (s_WindowSize - 1)];
+                }
+                insert(i);
+            }
+
+            if (bestLength >= s_MinMatch)
+            {
+                int symbol = tables.LengthSymbol[bestLength];
+                bits.Put(tables.LiteralCode[257 + symbol], tables.LiteralBits[257 + symbol]);
+                bits.Put(bestLength - s_LengthBase[symbol], s_LengthExtra[symbol]);
+                symbol = tables.DistanceSymbol[bestDistance];
+                bits.Put(tables.DistanceCode[symbol], 5);
+                bits.Put(bestDistance - s_DistanceBase[symbol], s_DistanceExtra[symbol]);
+                if (effort.InsertMatched)
+                {
+                    for (size_t position = i + 1; position < i + bestLength && position + s_MinMatch <= size; position++)
+                        insert(position);
+                }
+                i += bestLength;
+            }
+            else
+            {
+                bits.Put(tables.LiteralCode[data[i]], tables.LiteralBits[data[i]]);
+                i++;
+            }
+        }
+        bits.Put(tables.LiteralCode[256], tables.LiteralBits[256]);
+
+        if (!last)
+        {
+            bits.Put(0, 3);
+            bits.Align();
+            out.insert(out.end(), { 0x00, 0x00, 0xFF, 0xFF });
+        }
+        bits.Align();
+    }
+
+    // Stored blocks of at most 65535 bytes; they always end on a byte boundary
+    void StoreStrip(const unsigned char* data, size_t size, bool last, std::vector<unsigned char>& out)
+    {
+        do
+        {
+            size_t block = std::min(size, (size_t)65535);
+            out.push_back(last && block == size ? 1 : 0);
+            out.push_back((unsigned char)block);
+            out.push_back((unsigned char)(block >> 8));
+            out.push_back((unsigned char)~block);
+            out.push_back((unsigned char)(~block >> 8));
+            out.insert(out.end(), data, data + block);
+            data += block;
+            size -= block;
+        } while (size > 0);
+    }
+
+    bool WriteFile(const std::string& filepath, const std::vector<unsigned char>& bytes)
+    {
+        FILE* file = fopen(filepath.c_str(), "wb");
+        if (!file)
+            return false;
+        bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        return fclose(file) == 0 && written;
+    }
+}
+
+PngWriter::PngWriter(PngCompression compression, int threads, std::function<void(const PngWritten&)> onWritten)
+    : m_Compression(compression), m_Threads(threads), m_OnWritten(onWritten)
+{
+    m_Thread = std::thread(&PngWriter::Run, this);
+}
+
+PngWriter::~PngWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Stopping = true;
+    }
+    m_Changed.notify_all();
+    m_Thread.join();
+}
+
+void PngWriter::Write(const std::string& filepath, std::vector<unsigned char> pixels, int width, int height, int channels)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Jobs.push_back({ filepath, std::move(pixels), width, height, channels });
+        m_Pending++;
+    }
+    m_Changed.notify_all();
+}
+
+bool PngWriter::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    m_Changed.wait(lock, [this] { return m_Pending == 0; });
+    bool written = m_Failures == 0;
+    m_Failures = 0;
+    return written;
+}
+
+void PngWriter::Run()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_Lock);
+            m_Changed.wait(lock, [this] { return m_Stopping || !m_Jobs.empty(); });
+            // queued writes are finished before stopping
+            if (m_Jobs.empty())
+                return;
+            job = std::move(m_Jobs.front());
+            m_Jobs.pop_front();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<unsigned char> png = Encode(job.Pixels.data(), job.Width, job.Height, job.Channels, m_Compression, m_Threads);
+        PngWritten written;
+        written.Filepath = job.Filepath;
+        written.Written = !png.empty() && WriteFile(job.Filepath, png);
+        written.Bytes = png.size();
+        written.EncodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (m_OnWritten)
+            m_OnWritten(written);
+
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            if (!written.Written)
+                m_Failures++;
+            m_Pending--;
+        }
+        m_Changed.notify_all();
+    }
+}
+
+std::vector<unsigned char> PngWriter::Encode(const unsigned char* pixels, int width, int height, int channels,
+                                             PngCompression compression, int threads)
+{
+    if (!pixels || width < 1 || height < 1 || channels < 1 || channels > 4)
+        return {};
+    if (threads < 1)
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+    int rowBytes = width * channels;
+    size_t filteredRow = (size_t)rowBytes + 1;
+    int stripRows = (int)std::max((size_t)1, s_StripBytes / filteredRow);
+    stripRows = std::min(stripRows, std::max(1, (height + 2 * threads - 1) / (2 * threads)));
+    int strips = (height + stripRows - 1) / stripRows;
+    Effort effort = compression == PNG_FAST ? Effort{ 1, false } : Effort{ 32, true };
+
+    // each strip becomes a complete IDAT chunk; the first one also carries the zlib header
+    std::vector<std::vector<unsigned char>> chunks(strips);
+    std::vector<uint32_t> adlers(strips);
+    std::vector<size_t> sizes(strips);
+    std::atomic<int> nextStrip(0);
+    auto encodeStrips = [&]() {
+        std::vector<unsigned char> filtered, scratch(rowBytes);
+        for (int strip = nextStrip++; strip < strips; strip = nextStrip++)
+        {
+            int y0 = strip * stripRows, y1 = std::min(height, y0 + stripRows);
+            filtered.resize((y1 - y0) * filteredRow);
+            for (int y = y0; y < y1; y++)
+            {
+                const unsigned char* row = pixels + (size_t)y * rowBytes;
+                FilterRow(row, y > 0 ? row - rowBytes : nullptr, rowBytes, channels, compression != PNG_STORE,
+                          scratch.data(), &filtered[(y - y0) * filteredRow]);
+            }
+            adlers[strip] = Adler32(filtered.data(), filtered.size());
+            sizes[strip] = filtered.size();
+
+            std::vector<unsigned char>& chunk = chunks[strip];
+            chunk.reserve(compression == PNG_STORE ? filtered.size() + filtered.size() / 65535 * 5 + 32 : filtered.size() / 2 + 64);
+            size_t start = BeginChunk(chunk, "IDAT");
+            if (strip == 0)
+            {
+                // deflate with a 32 KiB window; the level byte is informative only
+                unsigned char level = compression == PNG_STORE ? 0x01 : compression == PNG_FAST ? 0x5E : 0x9C;
+                chunk.insert(chunk.end(), { 0x78, level });
+            }
+            bool last = strip == strips - 1;
+            if (compression == PNG_STORE)
+                StoreStrip(filtered.data(), filtered.size(), last, chunk);
+            else
+                DeflateStrip(filtered.data(), filtered.size(), effort, last, chunk);
+            EndChunk(chunk, start);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < std::min(threads, strips); t++)
+        workers.emplace_back(encodeStrips);
+    encodeStrips();
+    for (std::thread& worker : workers)
+        worker.join();
+
+    std::vector<unsigned char> png(s_Signature, s_Signature + 8);
+    size_t start = BeginChunk(png, "IHDR");
+    PutBigEndian(png, (uint32_t)width);
+    PutBigEndian(png, (uint32_t)height);
+    static const unsigned char s_ColorTypes[4] = { 0, 4, 2, 6 };
+    png.insert(png.end(), { 8, s_ColorTypes[channels - 1], 0, 0, 0 });
+    EndChunk(png, start);
+
+    size_t total = png.size();
+    for (const std::vector<unsigned char>& chunk : chunks)
+        total += chunk.size();
+    png.reserve(total + 28);
+    uint32_t adler = adlers[0];
+    for (int strip = 0; strip < strips; strip++)
+    {
+        png.insert(png.end(), chunks[strip].begin(), chunks[strip].end());
+        if (strip > 0)
+            adler = CombineAdler32(adler, adlers[strip], sizes[strip]);
+    }
+
+    // the zlib trailer follows the last strip in a small chunk of its own
+    start = BeginChunk(png, "IDAT");
+    PutBigEndian(png, adler);
+    EndChunk(png, start);
+    start = BeginChunk(png, "IEND");
+    EndChunk(png, start);
+    return png;
+}
+
+bool PngWriter::Save(const std::string& filepath, const unsigned char* pixels, int width, int height, int channels,
+                     PngCompression compression, int threads)
+{
+    std::vector<unsigned char> png = Encode(pixels, width, height, channels, compression, threads);
+    return !png.empty() && WriteFile(filepath, png);
+}
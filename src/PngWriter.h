@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum PngCompression
+{
+    PNG_STORE,    // no compression, for intermediate files that are read back soon
+    PNG_FAST,     // one match candidate per position
+    PNG_DEFAULT   // follows hash chains for longer matches
+};
+
+// Outcome of one queued write
+struct PngWritten
+{
+    std::string Filepath;
+    bool Written = false;
+    size_t Bytes = 0;        // size of the PNG file
+    double EncodeMs = 0;     // filtering, compression and file write
+};
+
+// 8-bit PNG encoder that compresses strips of rows in parallel. Every strip is filtered and deflated
+// on its own (no match reaches back into an earlier strip) and, except for the last one, ends with
+// an empty stored block so its bits stop on a byte boundary; the strips then form one zlib stream
+// in order, one IDAT chunk each, and their Adler-32 checksums are combined for the stream's trailer.
+//
+// Write() queues an image for a background thread and returns at once, so encoding overlaps with
+// whatever the caller renders next.
+class PngWriter
+{
+    private:
+        struct Job
+        {
+            std::string Filepath;
+            std::vector<unsigned char> Pixels;
+            int Width, Height, Channels;
+        };
+
+        PngCompression m_Compression;
+        int m_Threads;
+        std::function<void(const PngWritten&)> m_OnWritten;
+        std::deque<Job> m_Jobs;
+        int m_Pending = 0;     // queued or being encoded
+        int m_Failures = 0;    // since the last Wait()
+        bool m_Stopping = false;
+        std::mutex m_Lock;
+        std::condition_variable m_Changed;
+        std::thread m_Thread;
+
+        void Run();
+    public:
+        // threads = 0 encodes on one thread per hardware thread; onWritten is called on the
+        // background thread after every write
+        PngWriter(PngCompression compression = PNG_DEFAULT, int threads = 0,
+                  std::function<void(const PngWritten&)> onWritten = nullptr);
+        // finishes every queued write
+        ~PngWriter();
+
+        PngWriter(const PngWriter&) = delete;
+        PngWriter& operator=(const PngWriter&) = delete;
+
+        // Queues width x height pixels of channels (1-4: grey, grey + alpha, RGB, RGBA) bytes each
+        void Write(const std::string& filepath, std::vector<unsigned char> pixels, int width, int height, int channels);
+
+        // Blocks until the queue is empty; false if any write since the last Wait() failed
+        bool Wait();
+
+        // The PNG file as bytes, empty for an invalid size or channel count
+        static std::vector<unsigned char> Encode(const unsigned char* pixels, int width, int height, int channels,
+                                                 PngCompression compression = PNG_DEFAULT, int threads = 0);
+
+        // Encodes and writes on the calling thread
+        static bool Save(const std::string& filepath, const unsigned char* pixels, int width, int height, int channels,
+                         PngCompression compression = PNG_DEFAULT, int threads = 0);
+};
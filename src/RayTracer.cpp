@@ -0,0 +1,3588 @@
+#include <RayTracer.h>
+#include <Denoiser.h>
+#include <Checkpoint.h>
+#include <NumaTopology.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+
+using namespace std;
+
+const float PI = 3.14159265;
+
+/* Buffers written by the render workers */
+struct RenderTarget {
+    unsigned char* image;      // tiled framebuffer, see pixel_Offset()
+    int* objectIds = nullptr;  // id of the primary hit per pixel, -1 for background
+    GuideBuffers* guides = nullptr;  // primary hit normal/depth/id/albedo for the denoiser
+    GBuffer* gbuffer = nullptr;      // shading hit of every pixel, for relight()
+    AovBuffers* aovs = nullptr;      // requested output passes
+};
+
+/* Rays of the pixels a worker traces, gathered per cell for settings.touches */
+struct TouchRecorder {
+    TouchMap* touches;
+    Reader* scene;                    // the worker's copy of the scene
+    vector<int> cells;                // cells gathered so far, merged into touches at the end
+    vector<TouchedCell> gathered;
+    TouchedCell* current = nullptr;   // gathered cell of the pixel being traced
+    int currentCell = -1;
+};
+
+// set while a worker traces the pixels of a render with settings.touches
+thread_local TouchRecorder* touchRecorder = nullptr;
+
+// ray groups of TouchedCell::rays
+const int PRIMARY_RAYS = 0;
+const int SECONDARY_RAYS = 1;
+const int SHADOW_RAYS = 2;  // plus the light's index
+
+void grow_Bounds(Bounds3& bounds, vec3 point) {
+    bounds.lo = min(bounds.lo, point);
+    bounds.hi = max(bounds.hi, point);
+}
+
+void merge_Bounds(Bounds3& bounds, const Bounds3& other) {
+    bounds.lo = min(bounds.lo, other.lo);
+    bounds.hi = max(bounds.hi, other.hi);
+}
+
+void clear_Cell(TouchedCell& cell, int objects, int lights) {
+    cell.objects.assign((objects + 63) / 64, 0);
+    cell.rays.assign(SHADOW_RAYS + lights, RayBounds());
+}
+
+void merge_Cell(TouchedCell& cell, const TouchedCell& other) {
+    if (cell.objects.size() < other.objects.size())
+        cell.objects.resize(other.objects.size(), 0);
+    for (size_t w = 0; w < other.objects.size(); w++) {
+        cell.objects[w] |= other.objects[w];
+    }
+    for (size_t group = 0; group < cell.rays.size() && group < other.rays.size(); group++) {
+        merge_Bounds(cell.rays[group].start, other.rays[group].start);
+        merge_Bounds(cell.rays[group].end, other.rays[group].end);
+        merge_Bounds(cell.rays[group].origins, other.rays[group].origins);
+        merge_Bounds(cell.rays[group].directions, other.rays[group].directions);
+    }
+}
+
+void flush_Touches(TouchRecorder& recorder) {
+    std::lock_guard<std::mutex> guard(recorder.touches->lock);
+    for (size_t k = 0; k < recorder.cells.size(); k++) {
+        merge_Cell(recorder.touches->cells[recorder.cells[k]], recorder.gathered[k]);
+    }
+}
+
+// the rays that follow belong to pixel (x, y)
+void touch_Pixel(int x, int y) {
+    TouchRecorder* recorder = touchRecorder;
+    if (!recorder)
+        return;
+    int cell = x / TouchMap::CELL + recorder->touches->columns * (y / TouchMap::CELL);
+    if (cell == recorder->currentCell)
+        return;
+    // a tile covers only a few cells
+    size_t k = std::find(recorder->cells.begin(), recorder->cells.end(), cell) - recorder->cells.begin();
+    if (k == recorder->cells.size()) {
+        recorder->cells.push_back(cell);
+        recorder->gathered.emplace_back();
+        clear_Cell(recorder->gathered.back(), recorder->scene->objects->size(), recorder->scene->lights->size());
+    }
+    recorder->current = &recorder->gathered[k];
+    recorder->currentCell = cell;
+}
+
+void touch_Object(TouchRecorder* recorder, Surface* object) {
+    int id = object->getId();
+    if (id >= 0)
+        recorder->current->objects[id / 64] |= uint64_t(1) << (id % 64);
+}
+
+// adds a traced ray to its group; a ray that found only the excluded object found nothing
+void touch_Ray(int group, Ray& ray, Surface* excluded = nullptr) {
+    TouchRecorder* recorder = touchRecorder;
+    if (!recorder)
+        return;
+    vec3 direction = ray.getRayDirection();
+    if (!(length(direction) > 0))  // a degenerate ray hits nothing, however the objects move
+        return;
+    RayBounds& bounds = recorder->current->rays[group];
+    Surface* object = ray.getSceneObject();
+    if (object->getType() == NOTHING || object == excluded) {
+        grow_Bounds(bounds.origins, ray.getRayOrigin());
+        grow_Bounds(bounds.directions, normalize(direction));
+        return;
+    }
+    touch_Object(recorder, object);
+    grow_Bounds(bounds.start, ray.getRayOrigin());
+    grow_Bounds(bounds.end, ray.getHitPoint());
+}
+
+// adds the shadow ray from hit towards light; occluder is the object found in its way, if any
+void touch_Shadow(Ray& hit, Light* light, vec3 towardsLight, Surface* occluder) {
+    TouchRecorder* recorder = touchRecorder;
+    if (!recorder)
+        return;
+    if (occluder) {
+        touch_Object(recorder, occluder);
+        return;
+    }
+    vector<Light*>& lights = *recorder->scene->lights;
+    int index = std::find(lights.begin(), lights.end(), light) - lights.begin();
+    if (index == (int)lights.size())
+        return;
+    RayBounds& bounds = recorder->current->rays[SHADOW_RAYS + index];
+    if (light->type == SPOTLIGHT) {
+        grow_Bounds(bounds.start, hit.getHitPoint());
+        grow_Bounds(bounds.end, ((SpotLight*)light)->getPosition());
+    }
+    else {
+        grow_Bounds(bounds.origins, hit.getHitPoint());
+        grow_Bounds(bounds.directions, towardsLight);
+    }
+}
+
+/* Gathers the rays this worker traces into touches while in scope; nothing if touches is nullptr */
+struct TouchScope {
+    TouchRecorder recorder;
+
+    TouchScope(TouchMap* touches, Reader* scene) : recorder{ touches, scene } {
+        if (touches)
+            touchRecorder = &recorder;
+    }
+    ~TouchScope() {
+        if (recorder.touches) {
+            flush_Touches(recorder);
+            touchRecorder = nullptr;
+        }
+    }
+};
+
+void init_ray(Surface* closestObject, Ray reflectedRay){
+    closestObject = nothingSurface();
+    reflectedRay.setHitPoint(reflectedRay.getRayOrigin() + reflectedRay.getRayDirection());
+    reflectedRay.setSceneObject(closestObject);
+}
+
+float calcA(Ray ray){
+    vec3 direction = ray.getRayDirection();
+    float result = dot(direction, direction);
+    return result;
+}
+
+float calcB(vec3 oc, Ray ray){
+    vec3 direction = ray.getRayDirection();
+    float result = dot(oc, direction);
+    return 2.0f * result;
+}
+
+float calcC(vec3 oc, Sphere* sph){
+    float result = dot(oc, oc);
+    float multi = sph->getRadius() * sph->getRadius();
+    return result - multi;
+}
+// camera ray through pixel (j, i), offset from its centre by a fraction of a pixel
+Ray primary_Ray(int j, int i, Reader* scene, vec2 offset = vec2(0, 0)) {
+
+    float width = 2.0f / 800.0f;
+    float height = 2.0f / 800.0f;
+
+    vec3 pixelCenter(-1 + width / 2, 1 - height / 2, 0);
+    vec3 exactPixel = pixelCenter + vec3(j * width, -1 * (i * height), 0);
+    if (offset != vec2(0, 0))
+        exactPixel += vec3(offset.x * width, -offset.y * height, 0);
+    vec3 eyeVec = scene->eye->getCoordinates();
+    vec3 rayDirection = normalize(exactPixel - eyeVec);
+    return Ray(rayDirection, eyeVec);
+}
+
+// smallest root of a*t^2 + b*t + c = 0 that is past the surface epsilon, -1 if there is none
+float sphere_Root(float a, float b, float c) {
+    float t = 0.0;
+    float quad_delta = b * b - 4 * a * c; // Discriminant of the quadratic equation
+
+    if (quad_delta >= 0) {
+        float quad_ans1 = (-b - sqrt(quad_delta)) / (2.0f * a);
+        float quad_ans2 = (-b + sqrt(quad_delta)) / (2.0f * a);
+
+        if (quad_ans1 < 0 && quad_ans2 < 0) {
+            t = -1.0f; // no intersection
+
+        }
+        float first;
+        if(quad_ans1 >= 0)
+            first = quad_ans1;
+        else
+            first = quad_ans2;
+
+        if (first <= 0.0001f) {
+            float second = (quad_ans1 >= 0 && quad_ans2 >= 0) ? glm::max(quad_ans1, quad_ans2) : -1.0f;
+            t = second;
+
+        }
+        else {
+            t = first;
+
+        }
+    }
+    else {
+        t = -1.0f;
+    }
+    return t;
+}
+
+// ray parameter of the hit with currentObject, negative if the ray misses it
+float hit_Distance(Ray& ray, Surface* currentObject) {
+    float t = 0.0;
+
+    if (currentObject->getObjectClass() == SPHERE) {       // sphere
+        vec3 oc = ray.getRayOrigin() - currentObject->getPosition();
+        float a, b, c;
+        a = calcA(ray);
+        b = calcB(oc, ray);
+        c = calcC(oc, (Sphere*)currentObject);
+        t = sphere_Root(a, b, c);
+    }
+
+    else { // plane
+        float denominator = glm::dot(ray.getRayDirection(), currentObject->getPosition());
+
+        if (abs(denominator) < 0.0001f) {
+            t = -1.0f; // No intersection
+
+        }
+        // intersection equation
+        t = -(glm::dot(ray.getRayOrigin(), currentObject->getPosition()) + ((Plane*)currentObject)->getD()) / denominator;
+
+        if (t < 0.0f) {
+            t = -1.0f; // No intersection
+        }
+    }
+    return t;
+}
+
+Ray UpdateRay(int j, int i, Surface* ob, bool update, Ray reflectedRay, Reader* scene) {
+
+    if (!update) {
+        Ray primary = primary_Ray(j, i, scene);
+        reflectedRay.setRayDirection(primary.getRayDirection());
+        reflectedRay.setRayOrigin(primary.getRayOrigin());
+    }
+
+    // update the ray
+    Surface* closestObject = NULL;
+    init_ray(closestObject, reflectedRay);
+    float nearest_obj = INFINITY;
+
+    for (int i = 0; i < scene->objects->size(); i++) {
+        Surface* currentObject = scene->objects->at(i);
+        if (currentObject != ob) {
+            float t = hit_Distance(reflectedRay, currentObject);
+            if ((t >= 0) && t < nearest_obj) {
+                closestObject = currentObject;
+                nearest_obj = t;
+                reflectedRay.setSceneObject(closestObject);
+                reflectedRay.setHitPoint(reflectedRay.getRayOrigin() + reflectedRay.getRayDirection() * nearest_obj);
+            }
+        }
+    }
+
+    return reflectedRay;
+}
+
+vec3 get_Normal(vec3 hit_point, Surface* obj) {
+    if (obj->getObjectClass() == SPHERE) {
+        return normalize(hit_point - ((Sphere*)obj)->getPosition());
+    }
+    else
+        return normalize(vec3(obj->getCoordinates()));
+}
+
+float calc_defuse(vec3 N, Ray ray, Light* light) { //defuse
+
+    if (ray.getSceneObject()->getObjectClass() == SPHERE) {
+        vec3 light_Direction = normalize(light->direction);
+        if (light->type == SPOTLIGHT) {
+            vec3 SpotRay = normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
+            float cos = dot(SpotRay, light_Direction);
+            if (cos >= ((SpotLight*)light)->getAngle()){
+
+                light_Direction = SpotRay;
+                cos = dot(N, -light_Direction);
+                return glm::max(cos, 0.0f);;
+            }
+            else {
+                return 0.0f;
+            }
+        }
+        else { // DIRECTIONAL
+            float cos = dot(N, -light_Direction);
+            return glm::max(cos, 0.0f);;
+        }
+    }
+    else { // PLANE
+        vec3 light_Direction = -normalize(light->direction);
+        if (light->type == SPOTLIGHT) {
+            vec3 SpotRay = normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
+            float cos = dot(SpotRay, -light_Direction);
+            if (cos >= ((SpotLight*)light)->getAngle()){
+                light_Direction = -SpotRay;
+                cos = dot(N, -light_Direction);
+                return glm::max(cos, 0.0f);;
+            }
+            else {
+                return 0.0f;
+            }
+        }
+        else { // DIRECTIONAL
+            float cos = dot(N, -light_Direction);
+            return glm::max(cos, 0.0f);
+        }
+    }
+}
+
+float calc_specular(vec3 V, Ray ray, Light* light) { //specular
+    if (ray.getSceneObject()->getObjectClass() == SPHERE) { // sphere
+        vec3 light_Direction = normalize(light->direction);
+        vec3 normal_Sphere = get_Normal(ray.getHitPoint(), ray.getSceneObject());
+
+        if (light->type == SPOTLIGHT) { // SPOTLIGHT
+            vec3 Spot_Ray = normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
+            float cos = dot(Spot_Ray, light_Direction);
+            if (cos >= ((SpotLight*)light)->getAngle()) {
+                light_Direction = Spot_Ray;
+                vec3 reflected_Equation = light_Direction - 2.0f * normal_Sphere * dot(light_Direction, normal_Sphere);
+                float cos = dot(V, reflected_Equation);
+                cos = glm::max(0.0f, cos);
+                return pow(cos, ray.getSceneObject()->getShininess());
+            }
+            else {
+                return 0.0f;
+            }
+        }
+        else { // DIRECTIONAL
+            vec3 reflected_Equation = light_Direction - 2.0f * normal_Sphere * dot(light_Direction, normal_Sphere);
+            float cos = dot(V, reflected_Equation);
+            cos = glm::max(0.0f, cos);
+            return pow(cos, ray.getSceneObject()->getShininess());
+        }
+    }
+
+    else { // plane
+        vec3 light_Direction = normalize(light->direction);
+        vec3 normal_Plane = get_Normal(ray.getHitPoint(), ray.getSceneObject());
+        if (light->type == DIRECTIONAL) {
+            vec3 reflected_Equation = light_Direction - 2.0f * normal_Plane * dot(light_Direction, normal_Plane);
+            float cos = dot(V, reflected_Equation);
+            cos = glm::max(0.0f, cos);
+            return pow(cos, ray.getSceneObject()->getShininess());
+        }
+        else {
+            vec3 SpotRay = normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
+            float cos = dot(SpotRay, light_Direction);
+            if (cos < ((SpotLight*)light)->getAngle()) {
+                return 0.0f;
+            }
+            else {
+                light_Direction = SpotRay;
+                vec3 reflected_Equation = light_Direction - 2.0f * normal_Plane * dot(light_Direction, normal_Plane);
+                float cos = dot(V, reflected_Equation);
+                cos = glm::max(0.0f, cos);
+                return pow(cos, ray.getSceneObject()->getShininess());
+            }
+        }
+    }
+}
+
+float calc_shadow(Ray ray, Light* light, Reader* scene) { //shadow
+
+    vec3 light_Direction = glm::normalize(light->direction);
+    float closest_obj = INFINITY;
+
+    if (light->type == SPOTLIGHT) {
+        vec3 SpotRay = glm::normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
+        float cos = dot(SpotRay, light_Direction);
+
+        if (cos >= ((SpotLight*)light)->getAngle()) {
+            light_Direction = SpotRay;
+            vec3 position = ((SpotLight*)light)->getPosition();
+            vec3 hit_point = ray.getHitPoint();
+            closest_obj = glm::length(position - hit_point);
+        }
+        else {
+            return 0.0f;
+        }
+    }
+
+    for (int i = 0; i < scene->objects->size(); i++) {
+        Surface* currentObject = scene->objects->at(i);
+
+        if (currentObject != ray.getSceneObject()) {
+            Ray ray_oppo = Ray(-light_Direction, ray.getHitPoint());
+            float temp = hit_Distance(ray_oppo, currentObject);
+
+            if ((temp > 0) && (temp < closest_obj)) {
+                touch_Shadow(ray, light, -light_Direction, currentObject);
+                return 0.0;
+            }
+
+        }
+    }
+
+    touch_Shadow(ray, light, -light_Direction, nullptr);
+    return 1.0;
+}
+
+// calc Snell Law
+Ray calc_Snell_Law(Ray ray, glm::vec3 N, glm::vec3 rayDirection, float snellFrac) {
+    vec3 normal_surface = get_Normal(-ray.getHitPoint(), ray.getSceneObject());
+    float cos_a = dot(normal_surface, -ray.getRayDirection());
+    float theta_a = acos(cos_a) * (180.0f / PI);
+
+    // change in transparent sphere
+    float snell_Fraction = (1.0f / 1.5f);
+
+    float sin_a = sin(theta_a * (PI / 180.0f));
+    float sin_b = snell_Fraction * sin_a;
+    float theta_b = asin(sin_b) * (180.0f / PI);
+    float cos_b = cos(theta_b * (PI / 180.0f));
+
+    vec3 calc_snellMulti1 = (snellFrac * cos_a - cos_b) * N;
+    vec3 calc_snellMulti2 = snellFrac * (-ray.getRayDirection());
+    vec3 direc_ray = calc_snellMulti1 - calc_snellMulti2;
+    Ray new_Ray(direc_ray, ray.getHitPoint());
+    return new_Ray;
+}
+
+// Shading factors of one light at an OBJ surface hit
+GBuffer::LightTerms light_Terms(Ray& currentRay, vec3 normal, vec3 viewDirection, Light* light, Reader* scene, bool shadows) {
+    GBuffer::LightTerms terms;
+    terms.diffuse = calc_defuse(normal, currentRay, light);
+    terms.specular = calc_specular(viewDirection, currentRay, light);
+    terms.visibility = shadows ? calc_shadow(currentRay, light, scene) : 1.0f;
+    return terms;
+}
+
+// Diffuse and specular light of every light at an OBJ surface hit, each shadowed if shadows is set.
+// termsOut, if given, receives the factors of every light. knownTerms, if given, holds factors
+// already computed for the same hit, nullptr for the lights whose factors must be computed.
+vec3 direct_Light(Ray& currentRay, vec3 color, vec3 normal, vec3 viewDirection, Reader* scene, bool shadows,
+                  GBuffer::LightTerms* termsOut = nullptr, const GBuffer::LightTerms* const* knownTerms = nullptr) {
+    vec3 accumulatedLight(0, 0, 0);
+    for (int lightIndex = 0; lightIndex < scene->lights->size(); ++lightIndex) {
+        vec3 specularReflectance(0.7f, 0.7f, 0.7f);
+        vec3 diffuseReflectance = color * scene->lights->at(lightIndex)->getIntensity();
+        specularReflectance *= scene->lights->at(lightIndex)->getIntensity();
+
+        GBuffer::LightTerms terms = knownTerms && knownTerms[lightIndex] ? *knownTerms[lightIndex]
+            : light_Terms(currentRay, normal, viewDirection, scene->lights->at(lightIndex), scene, shadows);
+        if (termsOut)
+            termsOut[lightIndex] = terms;
+
+        vec3 diffuseComponent = diffuseReflectance * terms.diffuse;
+        vec3 specularComponent = specularReflectance * terms.specular;
+        accumulatedLight += (diffuseComponent + specularComponent) * terms.visibility;
+    }
+    return accumulatedLight;
+}
+
+/* Lighting passes of one camera sample, see AovBuffers */
+struct AovSample {
+    vec3 direct = vec3(0, 0, 0);
+    vec3 reflected = vec3(0, 0, 0);
+};
+
+/* The OBJ hit a pixel's colour was shaded at; terms, if set, receives its light factors */
+struct ShadedHit {
+    Ray ray = Ray(vec3(0, 0, 0), vec3(0, 0, 0));
+    GBuffer::LightTerms* terms = nullptr;
+};
+
+// shadedHit, if given, receives the OBJ hit the colour was shaded at; mirrors and glass only
+// pass on the colour found further along, so it is the only light-dependent part of a pixel.
+// aov, if given, receives the light of this hit and the colour passed on to it.
+vec4 GetPixelColor(int pixelX, int pixelY, Ray currentRay, int recursionDepth, Reader* scene, int maxDepth = 5, bool shadows = true,
+                   ShadedHit* shadedHit = nullptr, AovSample* aov = nullptr) {
+    vec3 finalColor(0, 0, 0);
+    vec3 emittedLight(0, 0, 0);
+    vec3 accumulatedLight(0, 0, 0);
+    vec3 ambientReflectance(0, 0, 0);
+    vec3 ambientLight(0, 0, 0);
+    vec3 reflectiveComponent(0, 0, 0);
+    vec3 reflectedLight(0, 0, 0);
+    if (currentRay.getSceneObject()->getType() == OBJ) { // Handle OBJ type
+        ambientReflectance = currentRay.getSceneObject()->getColor(currentRay.getHitPoint());
+        ambientLight = vec3(scene->ambientLight->r, scene->ambientLight->g, scene->ambientLight->b);
+
+        vec3 normal = get_Normal(currentRay.getHitPoint(), currentRay.getSceneObject());
+        vec3 viewDirection = normalize(currentRay.getRayOrigin() - currentRay.getHitPoint());
+        accumulatedLight = direct_Light(currentRay, ambientReflectance, normal, viewDirection, scene, shadows,
+                                        shadedHit ? shadedHit->terms : nullptr);
+        if (shadedHit)
+            shadedHit->ray = currentRay;
+        if (aov)
+            aov->direct = ambientReflectance * ambientLight + accumulatedLight;
+    }
+
+    finalColor = emittedLight + (ambientReflectance * ambientLight) + accumulatedLight + (reflectiveComponent * reflectedLight);
+
+    if (currentRay.getSceneObject()->getType() == REFLECTIVE) { // Handle reflective type
+        if (recursionDepth >= maxDepth) {
+            return vec4(0.f, 0.f, 0.f, 0.f);
+        }
+
+        vec3 reflectionDirection = currentRay.getRayDirection() - 2.0f * get_Normal(currentRay.getHitPoint(), currentRay.getSceneObject()) * dot(currentRay.getRayDirection(), get_Normal(currentRay.getHitPoint(), currentRay.getSceneObject()));
+        Ray reflectedRay(reflectionDirection, currentRay.getHitPoint());
+        reflectedRay = UpdateRay(pixelX, pixelY, currentRay.getSceneObject(), true, reflectedRay, scene);
+        touch_Ray(SECONDARY_RAYS, reflectedRay);
+
+        if (reflectedRay.getSceneObject()->getType() == NOTHING) {
+            return vec4(0.f, 0.f, 0.f, 0.f);
+        }
+
+        vec4 reflectedColor = GetPixelColor(pixelX, pixelY, reflectedRay, recursionDepth + 1, scene, maxDepth, shadows, shadedHit);
+        finalColor = vec3(reflectedColor.r, reflectedColor.g, reflectedColor.b);
+        if (aov)
+            aov->reflected = finalColor;
+    }
+
+    if (currentRay.getSceneObject()->getType() == TRANSPARENT) { // Handle transparent type
+        if (recursionDepth >= maxDepth) {
+            return vec4(0.f, 0.f, 0.f, 0.f);
+        }
+
+        vec3 surfaceNormal = get_Normal(currentRay.getHitPoint(), currentRay.getSceneObject());
+        float refractionRatio = (0.5f / 1.5f); // tran ratio
+        Ray refractedRay = calc_Snell_Law(currentRay, surfaceNormal, currentRay.getRayDirection(), refractionRatio);
+
+        refractedRay = UpdateRay(pixelX, pixelY, nothingSurface(), true, refractedRay, scene);
+        touch_Ray(SECONDARY_RAYS, refractedRay);
+
+        Surface* currentObject = currentRay.getSceneObject();
+        float intersectionDistance = 0.0f;
+
+        if (currentObject->getObjectClass() == PLANE) {
+            float denominator = glm::dot(currentRay.getRayDirection(), currentObject->getPosition());
+
+            if (abs(denominator) < 0.0001f) {
+                intersectionDistance = -1.0f;
+            }
+
+            intersectionDistance = -(glm::dot(currentRay.getRayOrigin(), currentObject->getPosition()) + ((Plane*)currentObject)->getD()) / denominator;
+
+            if (intersectionDistance < 0.0f) {
+                intersectionDistance = -1.0f;
+            }
+        } else {
+            vec3 rayOriginOffset = currentRay.getRayOrigin() - currentObject->getPosition();
+            float a = calcA(currentRay);
+            float b = calcB(rayOriginOffset, currentRay);
+            float c = calcC(rayOriginOffset, (Sphere*)currentObject);
+
+            float discriminant = b * b - 4 * a * c;
+
+            if (discriminant < 0) {
+                intersectionDistance = -1.0f;
+            } else {
+                float quad_ans1 = (-b - sqrt(discriminant)) / (2.0f * a);
+                float quad_ans2 = (-b + sqrt(discriminant)) / (2.0f * a);
+
+                if (quad_ans1 < 0 && quad_ans2 < 0) {
+                    intersectionDistance = -1.0f;
+                }
+
+                float closest_Hit;
+                if(quad_ans1 >= 0)
+                    closest_Hit = quad_ans1;
+                else
+                    closest_Hit = quad_ans2;
+
+                if (closest_Hit <= 0.0001f) {
+                    float furtherHit = (quad_ans1 >= 0 && quad_ans2 >= 0) ? glm::max(quad_ans1, quad_ans2) : -1.0f;
+                    intersectionDistance = furtherHit;
+                } else {
+                    intersectionDistance = closest_Hit;
+                }
+            }
+        }
+
+        vec3 secondaryHitPoint = refractedRay.getRayOrigin() + refractedRay.getRayDirection() * intersectionDistance;
+        surfaceNormal = get_Normal(secondaryHitPoint, refractedRay.getSceneObject());
+        Ray transmittedRay = calc_Snell_Law(refractedRay, surfaceNormal, refractedRay.getRayDirection(), refractionRatio);
+
+        transmittedRay = UpdateRay(pixelX, pixelY, refractedRay.getSceneObject(), true, refractedRay, scene);
+        // keeps refractedRay's hit if no other object is in the way
+        touch_Ray(SECONDARY_RAYS, transmittedRay, refractedRay.getSceneObject());
+
+        if (transmittedRay.getSceneObject()->getType() == NOTHING) {
+            return vec4(0.f, 0.f, 0.f, 0.f);
+        }
+
+        vec4 transmittedColor = GetPixelColor(pixelX, pixelY, transmittedRay, recursionDepth + 1, scene, maxDepth, shadows, shadedHit);
+        finalColor = vec3(transmittedColor.r, transmittedColor.g, transmittedColor.b);
+        if (aov)
+            aov->reflected = finalColor;
+    }
+
+    finalColor = min(finalColor, vec3(1.0, 1.0, 1.0));
+    finalColor = max(finalColor, vec3(0.0, 0.0, 0.0));
+    return vec4(finalColor.r, finalColor.g, finalColor.b, 1.0);
+}
+
+///////////////////////
+// Tiled Framebuffer //
+///////////////////////
+
+// While rendering, pixels are stored in FB_BLOCK x FB_BLOCK blocks of contiguous RGBA8
+// (256 bytes), the blocks row by row, so a packet or tile touches a few cache lines and
+// pages instead of one per row. linearize() produces the row-major image for output.
+const int FB_BLOCK = 8;
+const int FB_BLOCKS_X = (width + FB_BLOCK - 1) / FB_BLOCK;
+const int FB_BLOCKS_Y = (height + FB_BLOCK - 1) / FB_BLOCK;
+const int FB_BLOCK_BYTES = FB_BLOCK * FB_BLOCK * 4;
+const int FB_BYTES = FB_BLOCKS_X * FB_BLOCKS_Y * FB_BLOCK_BYTES;
+
+// byte offset of pixel (x, y) in a tiled framebuffer
+inline int pixel_Offset(int x, int y) {
+    int block = x / FB_BLOCK + FB_BLOCKS_X * (y / FB_BLOCK);
+    return block * FB_BLOCK_BYTES + ((y % FB_BLOCK) * FB_BLOCK + x % FB_BLOCK) * 4;
+}
+
+// Copies a tiled framebuffer into a row-major width x height RGBA image. Every block row
+// is one contiguous copy, which the compiler turns into wide vector moves.
+void linearize(const unsigned char* framebuffer, unsigned char* image) {
+    for (int y = 0; y < (int)height; y++) {
+        for (int x = 0; x < (int)width; x += FB_BLOCK) {
+            std::memcpy(&image[(x + width * y) * 4], &framebuffer[pixel_Offset(x, y)], glm::min(FB_BLOCK, (int)width - x) * 4);
+        }
+    }
+}
+
+void write_Pixel(unsigned char* framebuffer, int x, int y, vec4 color) {
+    unsigned char* pixel = &framebuffer[pixel_Offset(x, y)];
+    pixel[0] = (unsigned char)(color.r * 255);
+    pixel[1] = (unsigned char)(color.g * 255);
+    pixel[2] = (unsigned char)(color.b * 255);
+    pixel[3] = (unsigned char)(color.a * 255);
+}
+
+///////////////////////////
+// Rasterized Visibility //
+///////////////////////////
+
+// The unnormalised camera ray through pixel (x, y), which primary_Ray() builds, is an affine
+// function of the pixel coordinates: columns[0] * x + columns[1] * y + columns[2]
+struct PixelRays {
+    dvec3 columns[3];
+};
+
+PixelRays pixel_Rays(Reader* scene) {
+    double pixel = 2.0 / 800.0;
+    dvec3 eye = dvec3(scene->eye->getCoordinates());
+    return { { dvec3(pixel, 0, 0), dvec3(0, -pixel, 0), dvec3(-1 + pixel / 2, 1 - pixel / 2, 0) - eye } };
+}
+
+/* Pixels an object can cover, as a conservative span per pixel row */
+struct RasterShape {
+    enum Kind { EVERYWHERE, ELLIPSE, HALF_SPACE } kind = EVERYWHERE;
+    dmat3 conic;         // ELLIPSE: (x, y, 1) conic (x, y, 1)^T >= 0 on the sphere's outline
+    double top, bottom;  // ELLIPSE: row extent of the outline
+    double leftY, rightY;  // ELLIPSE: rows of the outline's leftmost and rightmost points
+    dvec3 line;          // HALF_SPACE: dot(line, (x, y, 1)) <= slack where the plane is in front
+    double slack;
+};
+
+// Solves the outline's quadratic in x on row y; a negative discriminant (rounding at the
+// top and bottom) counts as a touching point
+void conic_Roots(const dmat3& k, double y, double& left, double& right) {
+    double a = k[0][0];
+    double b = 2 * (k[0][1] * y + k[0][2]);
+    double c = k[1][1] * y * y + 2 * k[1][2] * y + k[2][2];
+    double root = sqrt(glm::max(0.0, b * b - 4 * a * c));
+    left = glm::min((-b + root) / (2 * a), (-b - root) / (2 * a));
+    right = glm::max((-b + root) / (2 * a), (-b - root) / (2 * a));
+}
+
+// A sphere outlines a cone from the eye, which cuts the image plane in an ellipse; a ray hits
+// the sphere's line exactly when dot(d, oc)^2 >= |d|^2 (|oc|^2 - r^2). Spheres around the eye
+// or reaching behind it give no ellipse and are tested everywhere, like planes seen edge-on.
+RasterShape raster_Shape(const PixelRays& camera, Reader* scene, Surface* object) {
+    RasterShape shape;
+    dvec3 eye = dvec3(scene->eye->getCoordinates());
+    const dvec3* g = camera.columns;
+
+    if (object->getObjectClass() == SPHERE) {
+        dvec3 oc = eye - dvec3(object->getPosition());
+        double radius = ((Sphere*)object)->getRadius();
+        double c = dot(oc, oc) - radius * radius;
+        if (c <= 0)
+            return shape;
+        dmat3 k;
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) {
+                k[a][b] = dot(g[a], oc) * dot(g[b], oc) - c * dot(g[a], g[b]);
+            }
+        }
+        if (k[0][0] >= 0 || k[0][0] * k[1][1] - k[0][1] * k[0][1] <= 0 || determinant(k) == 0)
+            return shape;
+
+        // tangents x = t and y = t of the outline, from the dual conic
+        dmat3 dual = inverse(k);
+        double xRoot = sqrt(glm::max(0.0, dual[0][2] * dual[0][2] - dual[0][0] * dual[2][2]));
+        double yRoot = sqrt(glm::max(0.0, dual[1][2] * dual[1][2] - dual[1][1] * dual[2][2]));
+        double xExtremes[2] = { (dual[0][2] - xRoot) / dual[2][2], (dual[0][2] + xRoot) / dual[2][2] };
+        double yExtremes[2] = { (dual[1][2] - yRoot) / dual[2][2], (dual[1][2] + yRoot) / dual[2][2] };
+        double tangentY[2];
+        for (int e = 0; e < 2; e++) {
+            dvec3 point = dual * dvec3(1, 0, -xExtremes[e]);
+            tangentY[e] = point.y / point.z;
+        }
+        shape.kind = RasterShape::ELLIPSE;
+        shape.conic = k;
+        shape.top = glm::min(yExtremes[0], yExtremes[1]);
+        shape.bottom = glm::max(yExtremes[0], yExtremes[1]);
+        bool leftFirst = xExtremes[0] < xExtremes[1];
+        shape.leftY = leftFirst ? tangentY[0] : tangentY[1];
+        shape.rightY = leftFirst ? tangentY[1] : tangentY[0];
+        return shape;
+    }
+
+    // plane: hit in front of the eye where the ray runs against the eye's side of it
+    dvec3 normal = dvec3(object->getPosition());
+    double eyeSide = dot(eye, normal) + ((Plane*)object)->getD();
+    if (eyeSide == 0)
+        return shape;
+    double side = eyeSide > 0 ? 1 : -1;
+    shape.kind = RasterShape::HALF_SPACE;
+    shape.line = side * dvec3(dot(g[0], normal), dot(g[1], normal), dot(g[2], normal));
+    shape.slack = abs(shape.line.x) + abs(shape.line.y);
+    return shape;
+}
+
+// Narrows [x0, x1) to the pixels of row y the shape may cover, one pixel wider on every
+// side than the exact outline; false if there are none
+bool raster_Span(const RasterShape& shape, int y, int& x0, int& x1) {
+    double left, right;
+    if (shape.kind == RasterShape::EVERYWHERE)
+        return true;
+
+    if (shape.kind == RasterShape::HALF_SPACE) {
+        // line.x * x + rest <= slack
+        double rest = shape.line.y * y + shape.line.z - shape.slack;
+        if (shape.line.x == 0)
+            return rest <= 0;
+        double edge = -rest / shape.line.x;
+        if (shape.line.x > 0)
+            x1 = glm::min(x1, (int)glm::clamp(floor(edge) + 1, (double)INT_MIN / 2, (double)INT_MAX / 2));
+        else
+            x0 = glm::max(x0, (int)glm::clamp(ceil(edge), (double)INT_MIN / 2, (double)INT_MAX / 2));
+        return x0 < x1;
+    }
+
+    // ellipse over the rows [y - 1, y + 1]: its left edge is convex and its right edge concave
+    // in y, so their extremes lie at the ends of that band or at the outline's extreme points
+    double bandTop = glm::max((double)y - 1, shape.top), bandBottom = glm::min((double)y + 1, shape.bottom);
+    if (bandTop > bandBottom)
+        return false;
+    double minLeft = INFINITY, maxRight = -INFINITY;
+    for (double row : { bandTop, bandBottom }) {
+        conic_Roots(shape.conic, row, left, right);
+        minLeft = glm::min(minLeft, left);
+        maxRight = glm::max(maxRight, right);
+    }
+    if (shape.leftY > bandTop && shape.leftY < bandBottom) {
+        conic_Roots(shape.conic, shape.leftY, left, right);
+        minLeft = glm::min(minLeft, left);
+    }
+    if (shape.rightY > bandTop && shape.rightY < bandBottom) {
+        conic_Roots(shape.conic, shape.rightY, left, right);
+        maxRight = glm::max(maxRight, right);
+    }
+    x0 = glm::max(x0, (int)glm::max(floor(minLeft) - 1, (double)INT_MIN / 2));
+    x1 = glm::min(x1, (int)glm::min(ceil(maxRight) + 2, (double)INT_MAX / 2));
+    return x0 < x1;
+}
+
+// Same result as trace_Primary_Packets(), but each object only visits the pixels its outline
+// covers, row span by row span, and keeps the nearest hit in an object/depth buffer. The
+// depth of a covered pixel is the packet tracer's, so the buffers match it bit for bit.
+// Returns false when no object covers the tile.
+bool rasterize_Primary(Reader* scene, const Tile& tile, vector<Ray>& rays) {
+    int tileWidth = tile.x1 - tile.x0;
+    int tileHeight = tile.y1 - tile.y0;
+
+    rays.clear();
+    rays.reserve(tileWidth * tileHeight);
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            rays.push_back(primary_Ray(j, i, scene));
+        }
+    }
+
+    vector<float> depth(tileWidth * tileHeight, INFINITY);
+    vector<Surface*> closest(tileWidth * tileHeight, nullptr);
+    PixelRays camera = pixel_Rays(scene);
+    vec3 eye = scene->eye->getCoordinates();
+    bool covered = false;
+
+    for (Surface* object : *scene->objects) {
+        RasterShape shape = raster_Shape(camera, scene, object);
+        bool sphere = object->getObjectClass() == SPHERE;
+        vec3 oc = eye - object->getPosition();
+        float c = sphere ? calcC(oc, (Sphere*)object) : 0.0f;
+        vec3 normal = object->getPosition();
+        float numerator = sphere ? 0.0f : glm::dot(eye, normal) + ((Plane*)object)->getD();
+
+        for (int i = tile.y0; i < tile.y1; i++) {
+            int x0 = tile.x0, x1 = tile.x1;
+            if (!raster_Span(shape, i, x0, x1))
+                continue;
+            covered = true;
+            for (int j = x0; j < x1; j++) {
+                int p = (j - tile.x0) + (i - tile.y0) * tileWidth;
+                vec3 direction = rays[p].getRayDirection();
+                float t;
+                if (sphere) {
+                    float a = dot(direction, direction);
+                    float b = 2.0f * dot(oc, direction);
+                    t = sphere_Root(a, b, c);
+                }
+                else {
+                    t = -numerator / glm::dot(direction, normal);
+                    if (t < 0.0f) {
+                        t = -1.0f;
+                    }
+                }
+                if ((t >= 0) && t < depth[p]) {
+                    depth[p] = t;
+                    closest[p] = object;
+                }
+            }
+        }
+    }
+
+    for (int p = 0; p < (int)rays.size(); p++) {
+        if (closest[p]) {
+            rays[p].setSceneObject(closest[p]);
+            rays[p].setHitPoint(rays[p].getRayOrigin() + rays[p].getRayDirection() * depth[p]);
+        }
+    }
+    return covered;
+}
+
+/////////////////////////
+// Primary Ray Packets //
+/////////////////////////
+
+/* Side planes of the pyramid spanned by the eye and a tile's corner pixels */
+struct TileFrustum {
+    vec3 eye;
+    vec3 corners[4];  // unit directions of the corner pixels
+    vec3 normals[4];  // unit normals pointing into the pyramid
+    bool valid;       // false for degenerate tiles, which cull nothing
+};
+
+TileFrustum tile_Frustum(Reader* scene, const Tile& tile) {
+    TileFrustum frustum;
+    frustum.eye = scene->eye->getCoordinates();
+    frustum.valid = true;
+
+    vec3* corners = frustum.corners;
+    corners[0] = primary_Ray(tile.x0, tile.y0, scene).getRayDirection();
+    corners[1] = primary_Ray(tile.x1 - 1, tile.y0, scene).getRayDirection();
+    corners[2] = primary_Ray(tile.x1 - 1, tile.y1 - 1, scene).getRayDirection();
+    corners[3] = primary_Ray(tile.x0, tile.y1 - 1, scene).getRayDirection();
+    vec3 center = corners[0] + corners[1] + corners[2] + corners[3];
+
+    for (int k = 0; k < 4; k++) {
+        vec3 normal = cross(corners[k], corners[(k + 1) % 4]);
+        float side = dot(normal, center);
+        if (length(normal) < 1e-6f || abs(side) < 1e-9f) {
+            frustum.valid = false;
+            return frustum;
+        }
+        frustum.normals[k] = normalize(side > 0 ? normal : -normal);
+    }
+    return frustum;
+}
+
+// true if no ray of the frustum can hit the object; conservative by a small margin
+bool frustum_Culls(const TileFrustum& frustum, Surface* object) {
+    if (!frustum.valid)
+        return false;
+
+    if (object->getObjectClass() == SPHERE) {
+        vec3 toCenter = object->getPosition() - frustum.eye;
+        float radius = ((Sphere*)object)->getRadius();
+        float margin = radius + 1e-4f * (length(toCenter) + radius) + 1e-5f;
+        for (int k = 0; k < 4; k++) {
+            if (dot(frustum.normals[k], toCenter) < -margin)
+                return true;
+        }
+        return false;
+    }
+
+    // plane: every direction in the pyramid is a positive blend of the corner directions,
+    // so the sign of the hit distance is fixed if all corners agree on it
+    vec3 normal = object->getPosition();
+    float eyeSide = dot(frustum.eye, normal) + ((Plane*)object)->getD();
+    float epsilon = 1e-4f * length(normal);
+    if (abs(eyeSide) < 1e-6f)
+        return false;
+    for (int k = 0; k < 4; k++) {
+        float towards = dot(frustum.corners[k], normal);
+        if (eyeSide > 0 ? towards < epsilon : towards > -epsilon)
+            return false;
+    }
+    return true;
+}
+
+// Resolves the primary hit of every tile pixel (row-major). Objects outside the tile
+// frustum are culled once, then each packet is tested object by object so the per-object
+// terms shared by all rays leaving the eye are computed once per packet.
+// Returns false when nothing can be visible in the tile.
+bool trace_Primary_Packets(Reader* scene, const Tile& tile, int packetSize, vector<Ray>& rays) {
+    int tileWidth = tile.x1 - tile.x0;
+    int tileHeight = tile.y1 - tile.y0;
+
+    rays.clear();
+    rays.reserve(tileWidth * tileHeight);
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            rays.push_back(primary_Ray(j, i, scene));
+        }
+    }
+
+    TileFrustum frustum = tile_Frustum(scene, tile);
+    vector<Surface*> candidates;
+    for (Surface* object : *scene->objects) {
+        if (!frustum_Culls(frustum, object))
+            candidates.push_back(object);
+    }
+    if (candidates.empty())
+        return false;
+
+    vec3 eye = frustum.eye;
+    vector<float> nearest(packetSize * packetSize);
+    vector<Surface*> closest(packetSize * packetSize);
+    vector<int> packet(packetSize * packetSize);
+
+    for (int py = 0; py < tileHeight; py += packetSize) {
+        for (int px = 0; px < tileWidth; px += packetSize) {
+            int count = 0;
+            for (int y = py; y < glm::min(py + packetSize, tileHeight); y++) {
+                for (int x = px; x < glm::min(px + packetSize, tileWidth); x++) {
+                    packet[count] = x + y * tileWidth;
+                    nearest[count] = INFINITY;
+                    closest[count] = nullptr;
+                    count++;
+                }
+            }
+
+            for (Surface* object : candidates) {
+                if (object->getObjectClass() == SPHERE) {
+                    vec3 oc = eye - object->getPosition();
+                    float c = calcC(oc, (Sphere*)object);
+                    for (int r = 0; r < count; r++) {
+                        vec3 direction = rays[packet[r]].getRayDirection();
+                        float a = dot(direction, direction);
+                        float b = 2.0f * dot(oc, direction);
+                        float t = sphere_Root(a, b, c);
+                        if ((t >= 0) && t < nearest[r]) {
+                            nearest[r] = t;
+                            closest[r] = object;
+                        }
+                    }
+                }
+                else {
+                    vec3 normal = object->getPosition();
+                    float numerator = glm::dot(eye, normal) + ((Plane*)object)->getD();
+                    for (int r = 0; r < count; r++) {
+                        float t = -numerator / glm::dot(rays[packet[r]].getRayDirection(), normal);
+                        if (t < 0.0f) {
+                            t = -1.0f;
+                        }
+                        if ((t >= 0) && t < nearest[r]) {
+                            nearest[r] = t;
+                            closest[r] = object;
+                        }
+                    }
+                }
+            }
+
+            for (int r = 0; r < count; r++) {
+                if (closest[r]) {
+                    Ray& ray = rays[packet[r]];
+                    ray.setSceneObject(closest[r]);
+                    ray.setHitPoint(ray.getRayOrigin() + ray.getRayDirection() * nearest[r]);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Primary hits of every tile pixel (row-major) by rasterizing or by packets, whichever the
+// settings ask for; false when nothing can be visible in the tile
+bool trace_Primary(Reader* scene, const Tile& tile, const RenderSettings& settings, vector<Ray>& rays) {
+    if (settings.rasterPrimary)
+        return rasterize_Primary(scene, tile, rays);
+    return trace_Primary_Packets(scene, tile, settings.packetSize, rays);
+}
+
+// stores what pixel (x, y) sees in the target's optional per-pixel buffers
+void record_Primary(RenderTarget& target, int x, int y, Ray& ray) {
+    int p = x + width * y;
+    Surface* object = ray.getSceneObject();
+    if (target.objectIds)
+        target.objectIds[p] = object->getId();
+    if (target.gbuffer)
+        target.gbuffer->objectIds[p] = object->getId();
+
+    if (target.guides) {
+        GuideBuffers& guides = *target.guides;
+        guides.ObjectId[p] = object->getId();
+        if (object->getType() == NOTHING) {
+            guides.Normal[p] = vec3(0, 0, 0);
+            guides.Depth[p] = 0.0f;
+            guides.Albedo[p] = vec3(0, 0, 0);
+            return;
+        }
+        guides.Normal[p] = get_Normal(ray.getHitPoint(), object);
+        guides.Depth[p] = length(ray.getHitPoint() - ray.getRayOrigin());
+        guides.Albedo[p] = object->getType() == OBJ ? object->getColor(ray.getHitPoint()) : vec3(1, 1, 1);
+    }
+
+    if (target.aovs) {
+        AovBuffers& aovs = *target.aovs;
+        bool hit = object->getType() != NOTHING;
+        if (!aovs.depth.empty())
+            aovs.depth[p] = hit ? length(ray.getHitPoint() - ray.getRayOrigin()) : 0.0f;
+        if (!aovs.normal.empty())
+            aovs.normal[p] = hit ? get_Normal(ray.getHitPoint(), object) : vec3(0, 0, 0);
+        if (!aovs.objectId.empty())
+            aovs.objectId[p] = object->getId();
+    }
+}
+
+// whether the target's requested passes need the lighting of every sample
+bool wants_Lighting(const RenderTarget& target) {
+    return target.aovs && (!target.aovs->direct.empty() || !target.aovs->reflected.empty());
+}
+
+// stores the lighting passes of pixel (x, y)
+void record_Lighting(RenderTarget& target, int x, int y, const AovSample& lighting) {
+    AovBuffers& aovs = *target.aovs;
+    if (!aovs.direct.empty())
+        aovs.direct[x + width * y] = lighting.direct;
+    if (!aovs.reflected.empty())
+        aovs.reflected[x + width * y] = lighting.reflected;
+}
+
+// stores the OBJ hit pixel (x, y) was shaded at in the target's G-buffer, or its colour if
+// it was not shaded at any (the hit's ray then still hits nothing)
+void record_Shading(RenderTarget& target, int x, int y, ShadedHit& hit, vec4 color) {
+    if (!target.gbuffer)
+        return;
+    GBuffer::Texel& texel = target.gbuffer->texels[x + width * y];
+    Ray& shaded = hit.ray;
+    Surface* object = shaded.getSceneObject();
+    if (object->getType() != OBJ) {
+        texel.object = -1;
+        texel.albedo = vec3(color);
+        texel.alpha = color.a;
+        return;
+    }
+    texel.object = object->getId();
+    texel.position = shaded.getHitPoint();
+    texel.normal = get_Normal(shaded.getHitPoint(), object);
+    texel.view = normalize(shaded.getRayOrigin() - shaded.getHitPoint());
+    texel.albedo = object->getColor(shaded.getHitPoint());
+    texel.alpha = 1.0f;
+}
+
+// what decides a light's shadows
+LightPlacement light_Placement(Light* light) {
+    LightPlacement placement;
+    placement.type = light->type;
+    placement.direction = light->direction;
+    if (light->type == SPOTLIGHT) {
+        placement.position = ((SpotLight*)light)->getPosition();
+        placement.angle = ((SpotLight*)light)->getAngle();
+    }
+    return placement;
+}
+
+bool same_Placement(const LightPlacement& a, const LightPlacement& b) {
+    return a.type == b.type && a.direction == b.direction && a.position == b.position && a.angle == b.angle;
+}
+
+void fill_Tile(RenderTarget& target, const Tile& tile, vec4 color) {
+    ShadedHit background;
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            write_Pixel(target.image, j, i, color);
+            record_Primary(target, j, i, background.ray);
+            record_Shading(target, j, i, background, color);
+            if (wants_Lighting(target))
+                record_Lighting(target, j, i, AovSample());
+        }
+    }
+}
+
+// every camera ray of the tile misses; an object moved into its view must still find the tile
+void touch_Missed_Tile(Reader* scene, const Tile& tile) {
+    if (!touchRecorder)
+        return;
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            Ray ray = primary_Ray(j, i, scene);
+            touch_Pixel(j, i);
+            touch_Ray(PRIMARY_RAYS, ray);
+        }
+    }
+}
+
+// traces the rest of pixel (j, i)'s path from its primary hit and writes its colour
+void shade_Pixel(Reader* scene, int j, int i, Ray& ray, const RenderSettings& settings, RenderTarget& target) {
+    touch_Pixel(j, i);
+    touch_Ray(PRIMARY_RAYS, ray);
+    record_Primary(target, j, i, ray);
+    ShadedHit shaded;
+    if (target.gbuffer)
+        shaded.terms = target.gbuffer->lightTerms.data() + (j + width * i) * target.gbuffer->lights.size();
+    AovSample lighting;
+    bool lightingPasses = wants_Lighting(target);
+    vec4 color = GetPixelColor(j, i, ray, 0, scene, settings.maxDepth, settings.shadows, target.gbuffer ? &shaded : nullptr,
+                               lightingPasses ? &lighting : nullptr);
+    record_Shading(target, j, i, shaded, color);
+    if (lightingPasses)
+        record_Lighting(target, j, i, lighting);
+    write_Pixel(target.image, j, i, color);
+}
+
+// recursive engine: one GetPixelColor() call per pixel
+void render_Tile(Reader* scene, const Tile& tile, const RenderSettings& settings, RenderTarget& target) {
+    if (settings.rasterPrimary || settings.packetSize > 0) {
+        vector<Ray> rays;
+        if (!trace_Primary(scene, tile, settings, rays)) {
+            touch_Missed_Tile(scene, tile);
+            fill_Tile(target, tile, vec4(0.f, 0.f, 0.f, 1.f));
+            return;
+        }
+        int tileWidth = tile.x1 - tile.x0;
+        for (int p = 0; p < (int)rays.size(); p++) {
+            shade_Pixel(scene, tile.x0 + p % tileWidth, tile.y0 + p / tileWidth, rays[p], settings, target);
+        }
+        return;
+    }
+
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            Ray init_ray(vec3(0, 0, 0), vec3(0, 0, 0));
+            Ray ray = UpdateRay(j, i, nothingSurface(), false, init_ray, scene);
+            shade_Pixel(scene, j, i, ray, settings, target);
+        }
+    }
+}
+
+////////////////////////
+// Wavefront Renderer //
+////////////////////////
+
+/* A path whose current ray already has its closest hit resolved */
+struct PathState {
+    Ray ray;
+    int pixel;  // index into the tile's pixel list
+    int depth;
+};
+
+/* A spawned reflection/refraction ray waiting for the next intersection stage */
+struct PendingRay {
+    Ray ray;
+    Surface* exclude;  // object the ray leaves from
+    int pixel;
+    int depth;         // depth of the path that spawned the ray
+    bool refracted;    // refracted rays are traced once more past the object they enter
+};
+
+/* Unoccluded light contribution of an OBJ hit, resolved by the shadow stage */
+struct ShadowQuery {
+    int hit;    // index into the OBJ queue
+    int light;
+    vec3 contribution;
+    float visibility;
+};
+
+// A secondary ray that leaves the scene blacks out its pixel; only a miss right after the
+// primary hit keeps alpha at 0, deeper misses are composited back to opaque by the parents.
+vec4 missed_Color(int depth) {
+    return vec4(0.f, 0.f, 0.f, depth == 0 ? 0.f : 1.f);
+}
+
+// spreads the low 10 bits of v so they occupy every third bit
+uint32_t spread_Bits(uint32_t v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Orders pending rays by direction octant, then by the Morton code of their origin cell
+// inside the wave's bounds, so rays traced back to back touch the same objects.
+vector<int> coherent_Order(vector<PendingRay>& pending) {
+    vec3 lower(INFINITY), upper(-INFINITY);
+    for (PendingRay& next : pending) {
+        lower = min(lower, next.ray.getRayOrigin());
+        upper = max(upper, next.ray.getRayOrigin());
+    }
+    vec3 cellScale = 1023.0f / max(upper - lower, vec3(1e-6f));
+
+    vector<std::pair<uint64_t, int>> keys(pending.size());
+    for (int r = 0; r < (int)pending.size(); r++) {
+        vec3 direction = pending[r].ray.getRayDirection();
+        uint32_t octant = (direction.x < 0 ? 1 : 0) | (direction.y < 0 ? 2 : 0) | (direction.z < 0 ? 4 : 0);
+        uvec3 cell = uvec3((pending[r].ray.getRayOrigin() - lower) * cellScale);
+        uint32_t morton = spread_Bits(cell.x) | (spread_Bits(cell.y) << 1) | (spread_Bits(cell.z) << 2);
+        keys[r] = { ((uint64_t)octant << 30) | morton, r };
+    }
+    std::sort(keys.begin(), keys.end());
+
+    vector<int> order(pending.size());
+    for (int r = 0; r < (int)keys.size(); r++) {
+        order[r] = keys[r].second;
+    }
+    return order;
+}
+
+// Same result as render_Tile(), but every stage is a loop over a homogeneous queue
+void render_Tile_Wavefront(Reader* scene, const Tile& tile, const RenderSettings& settings, RenderStats* stats, RenderTarget& target) {
+    int tileWidth = tile.x1 - tile.x0;
+    int pixelCount = tileWidth * (tile.y1 - tile.y0);
+    vec3 ambientLight(scene->ambientLight->r, scene->ambientLight->g, scene->ambientLight->b);
+
+    vector<vec4> colors(pixelCount);
+    vector<PathState> wave, objQueue, reflectiveQueue, transparentQueue;
+    vector<PendingRay> pending;
+    vector<ShadowQuery> shadowQueries;
+    vector<vec3> ambientTerms;
+    wave.reserve(pixelCount);
+
+    // primary ray generation and intersection
+    if (settings.rasterPrimary || settings.packetSize > 0) {
+        vector<Ray> rays;
+        if (!trace_Primary(scene, tile, settings, rays)) {
+            fill_Tile(target, tile, vec4(0.f, 0.f, 0.f, 1.f));
+            return;
+        }
+        for (int p = 0; p < pixelCount; p++) {
+            wave.push_back({ rays[p], p, 0 });
+        }
+    }
+    else {
+        for (int p = 0; p < pixelCount; p++) {
+            Ray ray = primary_Ray(tile.x0 + p % tileWidth, tile.y0 + p / tileWidth, scene);
+            wave.push_back({ ray, p, 0 });
+        }
+        for (PathState& path : wave) {
+            path.ray = UpdateRay(0, 0, nothingSurface(), true, path.ray, scene);
+        }
+    }
+    for (PathState& path : wave) {
+        record_Primary(target, tile.x0 + path.pixel % tileWidth, tile.y0 + path.pixel / tileWidth, path.ray);
+    }
+
+    while (!wave.empty()) {
+        // split hits into per-material queues
+        objQueue.clear();
+        reflectiveQueue.clear();
+        transparentQueue.clear();
+        for (PathState& path : wave) {
+            switch (path.ray.getSceneObject()->getType()) {
+            case OBJ:
+                objQueue.push_back(path);
+                break;
+            case REFLECTIVE:
+                reflectiveQueue.push_back(path);
+                break;
+            case TRANSPARENT:
+                transparentQueue.push_back(path);
+                break;
+            default:
+                colors[path.pixel] = vec4(0.f, 0.f, 0.f, 1.f);
+                break;
+            }
+        }
+
+        // OBJ shading: ambient term and unoccluded diffuse + specular per light
+        shadowQueries.clear();
+        ambientTerms.resize(objQueue.size());
+        for (int h = 0; h < (int)objQueue.size(); h++) {
+            Ray& ray = objQueue[h].ray;
+            Surface* object = ray.getSceneObject();
+            vec3 albedo = object->getColor(ray.getHitPoint());
+            vec3 normal = get_Normal(ray.getHitPoint(), object);
+            vec3 viewDirection = normalize(ray.getRayOrigin() - ray.getHitPoint());
+            ambientTerms[h] = albedo * ambientLight;
+
+            for (int l = 0; l < (int)scene->lights->size(); l++) {
+                Light* light = scene->lights->at(l);
+                vec3 specularReflectance = vec3(0.7f, 0.7f, 0.7f) * light->getIntensity();
+                vec3 diffuseComponent = albedo * light->getIntensity() * calc_defuse(normal, ray, light);
+                vec3 specularComponent = specularReflectance * calc_specular(viewDirection, ray, light);
+                shadowQueries.push_back({ h, l, diffuseComponent + specularComponent, 0.0f });
+            }
+        }
+
+        // shadow rays
+        for (ShadowQuery& query : shadowQueries) {
+            query.visibility = settings.shadows ? calc_shadow(objQueue[query.hit].ray, scene->lights->at(query.light), scene) : 1.0f;
+        }
+
+        // resolve OBJ colors, accumulating lights in scene order
+        int q = 0;
+        for (int h = 0; h < (int)objQueue.size(); h++) {
+            vec3 accumulatedLight(0, 0, 0);
+            for (; q < (int)shadowQueries.size() && shadowQueries[q].hit == h; q++) {
+                accumulatedLight += shadowQueries[q].contribution * shadowQueries[q].visibility;
+            }
+            vec3 finalColor = vec3(0, 0, 0) + ambientTerms[h] + accumulatedLight + vec3(0, 0, 0);
+            finalColor = min(finalColor, vec3(1.0, 1.0, 1.0));
+            finalColor = max(finalColor, vec3(0.0, 0.0, 0.0));
+            colors[objQueue[h].pixel] = vec4(finalColor, 1.0);
+        }
+
+        // spawn reflection rays
+        pending.clear();
+        for (PathState& path : reflectiveQueue) {
+            if (path.depth >= settings.maxDepth) {
+                colors[path.pixel] = missed_Color(path.depth);
+                continue;
+            }
+            Ray& ray = path.ray;
+            vec3 normal = get_Normal(ray.getHitPoint(), ray.getSceneObject());
+            vec3 reflectionDirection = ray.getRayDirection() - 2.0f * normal * dot(ray.getRayDirection(), normal);
+            pending.push_back({ Ray(reflectionDirection, ray.getHitPoint()), ray.getSceneObject(), path.pixel, path.depth, false });
+        }
+
+        // spawn refraction rays
+        for (PathState& path : transparentQueue) {
+            if (path.depth >= settings.maxDepth) {
+                colors[path.pixel] = missed_Color(path.depth);
+                continue;
+            }
+            Ray& ray = path.ray;
+            vec3 surfaceNormal = get_Normal(ray.getHitPoint(), ray.getSceneObject());
+            float refractionRatio = (0.5f / 1.5f); // tran ratio
+            Ray refractedRay = calc_Snell_Law(ray, surfaceNormal, ray.getRayDirection(), refractionRatio);
+            pending.push_back({ refractedRay, nothingSurface(), path.pixel, path.depth, true });
+        }
+
+        // intersect the next wave, optionally in coherent order; results scatter back by pixel
+        auto sortStart = std::chrono::steady_clock::now();
+        vector<int> order;
+        if (settings.sortSecondary)
+            order = coherent_Order(pending);
+        auto traceStart = std::chrono::steady_clock::now();
+
+        wave.clear();
+        for (int r = 0; r < (int)pending.size(); r++) {
+            PendingRay& next = pending[settings.sortSecondary ? order[r] : r];
+            Ray ray = UpdateRay(0, 0, next.exclude, true, next.ray, scene);
+            if (next.refracted) {
+                ray = UpdateRay(0, 0, ray.getSceneObject(), true, ray, scene);
+            }
+            if (ray.getSceneObject()->getType() == NOTHING) {
+                colors[next.pixel] = missed_Color(next.depth);
+                continue;
+            }
+            wave.push_back({ ray, next.pixel, next.depth + 1 });
+        }
+
+        if (stats) {
+            auto traceEnd = std::chrono::steady_clock::now();
+            stats->secondaryRays += pending.size();
+            stats->sortNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(traceStart - sortStart).count();
+            stats->secondaryTraceNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(traceEnd - traceStart).count();
+        }
+    }
+
+    for (int p = 0; p < pixelCount; p++) {
+        write_Pixel(target.image, tile.x0 + p % tileWidth, tile.y0 + p / tileWidth, colors[p]);
+    }
+}
+
+// Screen tiles in Morton (Z) order, so tiles rendered back to back are neighbours and
+// share scene data and framebuffer pages
+vector<Tile> make_Tiles(int tileSize) {
+    vector<std::pair<uint32_t, Tile>> ordered;
+    for (int y = 0; y < (int)height; y += tileSize) {
+        for (int x = 0; x < (int)width; x += tileSize) {
+            uint32_t code = spread_Bits(x / tileSize) | (spread_Bits(y / tileSize) << 1);
+            ordered.push_back({ code, { x, y, glm::min(x + tileSize, (int)width), glm::min(y + tileSize, (int)height) } });
+        }
+    }
+    std::sort(ordered.begin(), ordered.end(), [](const std::pair<uint32_t, Tile>& a, const std::pair<uint32_t, Tile>& b) {
+        return a.first < b.first;
+    });
+
+    vector<Tile> tiles;
+    for (const auto& entry : ordered) {
+        tiles.push_back(entry.second);
+    }
+    return tiles;
+}
+
+/////////////////////////
+// Regions of Interest //
+/////////////////////////
+
+Tile region_Bounds(const vector<Tile>& regions) {
+    Tile bounds = { (int)width, (int)height, 0, 0 };
+    for (const Tile& region : regions) {
+        bounds = { glm::min(bounds.x0, region.x0), glm::min(bounds.y0, region.y0),
+                   glm::max(bounds.x1, region.x1), glm::max(bounds.y1, region.y1) };
+    }
+    return regions.empty() ? Tile{ 0, 0, (int)width, (int)height } : bounds;
+}
+
+bool in_Regions(const vector<Tile>& regions, int x, int y) {
+    for (const Tile& region : regions) {
+        if (x >= region.x0 && x < region.x1 && y >= region.y0 && y < region.y1)
+            return true;
+    }
+    return regions.empty();
+}
+
+vector<unsigned char> crop_Image(const unsigned char* image, const Tile& rect) {
+    vector<unsigned char> pixels;
+    for (int y = rect.y0; y < rect.y1; y++) {
+        pixels.insert(pixels.end(), &image[(rect.x0 + width * y) * 4], &image[(rect.x1 + width * y) * 4]);
+    }
+    return pixels;
+}
+
+void merge_Regions(const unsigned char* image, const vector<Tile>& regions, unsigned char* base) {
+    for (const Tile& region : regions) {
+        for (int y = region.y0; y < region.y1; y++) {
+            std::copy(&image[(region.x0 + width * y) * 4], &image[(region.x1 + width * y) * 4], &base[(region.x0 + width * y) * 4]);
+        }
+    }
+}
+
+// Pixels traced around each region so that its own pixels come out exactly as in a full
+// frame: anti-aliasing compares a pixel with its neighbours, and every a-trous pass reaches
+// 2 * 2^pass pixels further out
+int region_Margin(const RenderSettings& settings) {
+    int margin = settings.aaMaxSamples > 1 ? 1 : 0;
+    if (settings.denoisePasses > 0)
+        margin += 2 * ((1 << settings.denoisePasses) - 1);
+    return margin;
+}
+
+// The grid tiles, each cut down to the bounds of its pixels within the regions and their
+// margin, so overlapping regions never put a pixel in two tiles
+vector<Tile> render_Tiles(const RenderSettings& settings) {
+    vector<Tile> tiles = make_Tiles(settings.tileSize);
+    if (settings.regions.empty())
+        return tiles;
+
+    int margin = region_Margin(settings);
+    vector<Tile> clipped;
+    for (const Tile& tile : tiles) {
+        Tile bounds = { tile.x1, tile.y1, tile.x0, tile.y0 };
+        for (const Tile& region : settings.regions) {
+            int x0 = glm::max(tile.x0, region.x0 - margin), x1 = glm::min(tile.x1, region.x1 + margin);
+            int y0 = glm::max(tile.y0, region.y0 - margin), y1 = glm::min(tile.y1, region.y1 + margin);
+            if (x0 >= x1 || y0 >= y1)
+                continue;
+            bounds = { glm::min(bounds.x0, x0), glm::min(bounds.y0, y0), glm::max(bounds.x1, x1), glm::max(bounds.y1, y1) };
+        }
+        if (bounds.x0 < bounds.x1 && bounds.y0 < bounds.y1)
+            clipped.push_back(bounds);
+    }
+    return clipped;
+}
+
+// Blacks out (RGBA 0) every pixel of a row-major image outside the regions, including the margin
+void clear_Outside_Regions(unsigned char* image, const vector<Tile>& regions) {
+    // mark the regions first, so many small regions cost no more than one large one
+    vector<unsigned char> inside(width * height, 0);
+    for (const Tile& region : regions) {
+        for (int y = region.y0; y < region.y1; y++) {
+            std::fill(&inside[region.x0 + width * y], &inside[region.x1 + width * y], 1);
+        }
+    }
+    for (int p = 0; p < (int)(width * height); p++) {
+        if (!inside[p])
+            std::fill_n(&image[p * 4], 4, 0);
+    }
+}
+
+//////////////////////////////
+// Object-Edit Invalidation //
+//////////////////////////////
+
+// how far outside its exact shape an object still counts as reaching a ray, for rounding
+const float TOUCH_TOLERANCE = 1e-3f;
+
+Tile cell_Rect(int column, int row) {
+    return { column * TouchMap::CELL, row * TouchMap::CELL,
+             glm::min((column + 1) * TouchMap::CELL, (int)width), glm::min((row + 1) * TouchMap::CELL, (int)height) };
+}
+
+// Sizes the cells for scene and clears the ones the render traces in full: all of them without
+// regions, else those inside a region. The others keep their rays and add the ones traced now.
+void prepare_Touches(TouchMap& touches, Reader* scene, const vector<Tile>& regions) {
+    int columns = (width + TouchMap::CELL - 1) / TouchMap::CELL;
+    int rows = (height + TouchMap::CELL - 1) / TouchMap::CELL;
+    bool resized = touches.columns != columns || touches.rows != rows;
+    touches.columns = columns;
+    touches.rows = rows;
+    touches.cells.resize(columns * rows);
+
+    int objects = scene->objects->size();
+    int lights = scene->lights->size();
+    for (int row = 0; row < rows; row++) {
+        for (int column = 0; column < columns; column++) {
+            TouchedCell& cell = touches.cells[column + columns * row];
+            Tile rect = cell_Rect(column, row);
+            bool traced = regions.empty() || resized || (int)cell.rays.size() != SHADOW_RAYS + lights;
+            for (const Tile& region : regions) {
+                traced = traced || (rect.x0 >= region.x0 && rect.x1 <= region.x1 && rect.y0 >= region.y0 && rect.y1 <= region.y1);
+            }
+            if (traced)
+                clear_Cell(cell, objects, lights);
+            else
+                cell.objects.resize((objects + 63) / 64, 0);
+        }
+    }
+    if (regions.empty())
+        touches.scene = scene_Fingerprint(scene);
+}
+
+size_t touch_Bytes(const TouchMap& touches) {
+    size_t bytes = touches.cells.size() * sizeof(TouchedCell);
+    for (const TouchedCell& cell : touches.cells) {
+        bytes += cell.objects.size() * sizeof(uint64_t) + cell.rays.size() * sizeof(RayBounds);
+    }
+    return bytes;
+}
+
+bool empty_Bounds(const Bounds3& bounds) {
+    return bounds.lo.x > bounds.hi.x;
+}
+
+// corner k (0-7) of a box
+vec3 bounds_Corner(const Bounds3& bounds, int k) {
+    return vec3(k & 1 ? bounds.hi.x : bounds.lo.x, k & 2 ? bounds.hi.y : bounds.lo.y, k & 4 ? bounds.hi.z : bounds.lo.z);
+}
+
+void bounding_Sphere(const Bounds3& bounds, vec3& center, float& radius) {
+    center = (bounds.lo + bounds.hi) * 0.5f;
+    radius = length(bounds.hi - bounds.lo) * 0.5f;
+}
+
+// +1 or -1 if every corner of the box lies clearly on that side of the plane, 0 otherwise
+int plane_Side(Surface* plane, const Bounds3& bounds) {
+    vec3 normal = plane->getPosition();
+    float tolerance = TOUCH_TOLERANCE * length(normal);
+    int side = 0;
+    for (int k = 0; k < 8; k++) {
+        float distance = dot(normal, bounds_Corner(bounds, k)) + ((Plane*)plane)->getD();
+        int cornerSide = distance > tolerance ? 1 : distance < -tolerance ? -1 : 0;
+        if (cornerSide == 0 || (k > 0 && cornerSide != side))
+            return 0;
+        side = cornerSide;
+    }
+    return side;
+}
+
+// Unit axis and cosine of the half-angle of a cone around every direction in the box; false if
+// no cone under 90 degrees holds them. Such a cone is convex, so holding the corners is enough.
+bool direction_Cone(const Bounds3& directions, vec3& axis, float& cosAngle) {
+    vec3 middle = (directions.lo + directions.hi) * 0.5f;
+    if (length(middle) < 1e-6f)
+        return false;
+    axis = normalize(middle);
+    cosAngle = 1.0f;
+    for (int k = 0; k < 8; k++) {
+        vec3 corner = bounds_Corner(directions, k);
+        if (length(corner) < 1e-6f)
+            return false;
+        cosAngle = glm::min(cosAngle, dot(axis, corner) / length(corner));
+    }
+    return cosAngle > 0;
+}
+
+// Whether the object can lie on one of the rays. Every segment from a ball to another stays
+// within the larger radius of the segment between their centres, and every half-line from a ball
+// within its radius of the half-line from its centre, so spheres are tested grown by those radii.
+bool reaches_Rays(Surface* object, const RayBounds& rays) {
+    if (object->getObjectClass() == SPHERE) {
+        vec3 center = object->getPosition();
+        float radius = ((Sphere*)object)->getRadius() + TOUCH_TOLERANCE;
+        if (!empty_Bounds(rays.start)) {
+            vec3 a, b;
+            float spreadA, spreadB;
+            bounding_Sphere(rays.start, a, spreadA);
+            bounding_Sphere(rays.end, b, spreadB);
+            vec3 ab = b - a;
+            float s = dot(ab, ab) > 0 ? glm::clamp(dot(center - a, ab) / dot(ab, ab), 0.0f, 1.0f) : 0.0f;
+            if (length(center - (a + s * ab)) <= radius + glm::max(spreadA, spreadB))
+                return true;
+        }
+        if (!empty_Bounds(rays.origins)) {
+            vec3 origin, axis;
+            float spread, cosAngle;
+            bounding_Sphere(rays.origins, origin, spread);
+            vec3 toCenter = center - origin;
+            float distance = length(toCenter);
+            float reach = radius + spread;
+            if (distance <= reach || !direction_Cone(rays.directions, axis, cosAngle))
+                return true;
+            float angle = acos(glm::clamp(dot(toCenter / distance, axis), -1.0f, 1.0f));
+            if (angle <= acos(cosAngle) + asin(reach / distance) + TOUCH_TOLERANCE)
+                return true;
+        }
+        return false;
+    }
+
+    // plane: segments cross it only if their ends are not all on one side, and half-lines only
+    // if they head towards it
+    if (!empty_Bounds(rays.start)) {
+        int side = plane_Side(object, rays.start);
+        if (side == 0 || plane_Side(object, rays.end) != side)
+            return true;
+    }
+    if (!empty_Bounds(rays.origins)) {
+        int side = plane_Side(object, rays.origins);
+        if (side == 0)
+            return true;
+        vec3 normal = object->getPosition();
+        for (int k = 0; k < 8; k++) {
+            if (side * dot(normal, bounds_Corner(rays.directions, k)) < TOUCH_TOLERANCE * length(normal))
+                return true;
+        }
+    }
+    return false;
+}
+
+bool same_Shape(Surface* a, Surface* b) {
+    return a->getObjectClass() == b->getObjectClass() && a->getCoordinates() == b->getCoordinates();
+}
+
+// same in everything the renderer reads, as hashed by hash_Objects()
+bool same_Object(Surface* a, Surface* b) {
+    vec3 square(0.25f, 0.25f, 0.0f);
+    return same_Shape(a, b) && a->getType() == b->getType() && a->getColor(square) == b->getColor(square) &&
+           a->getShininess() == b->getShininess();
+}
+
+bool same_View_And_Lights(Reader* before, Reader* after) {
+    if (before->eye->coordinates != after->eye->coordinates || *before->ambientLight != *after->ambientLight ||
+        before->lights->size() != after->lights->size())
+        return false;
+    for (size_t k = 0; k < before->lights->size(); k++) {
+        Light* a = before->lights->at(k);
+        Light* b = after->lights->at(k);
+        if (!same_Placement(light_Placement(a), light_Placement(b)) || a->intensity != b->intensity)
+            return false;
+    }
+    return true;
+}
+
+vector<Tile> edited_Cells(Reader* before, Reader* after, const TouchMap& touches) {
+    bool everything = touches.cells.empty() || !same_View_And_Lights(before, after);
+
+    // objects whose old rays change, and new shapes that may cross the rays of any cell
+    int objects = glm::max(before->objects->size(), after->objects->size());
+    vector<uint64_t> changed((objects + 63) / 64, 0);
+    vector<Surface*> reshaped;
+    for (int i = 0; i < objects; i++) {
+        Surface* old = i < (int)before->objects->size() ? before->objects->at(i) : nullptr;
+        Surface* now = i < (int)after->objects->size() ? after->objects->at(i) : nullptr;
+        if (old && now && same_Object(old, now))
+            continue;
+        if (old)
+            changed[i / 64] |= uint64_t(1) << (i % 64);
+        if (now && !(old && same_Shape(old, now)))
+            reshaped.push_back(now);
+    }
+
+    vector<Tile> cells;
+    for (int row = 0; row < touches.rows; row++) {
+        for (int column = 0; column < touches.columns; column++) {
+            const TouchedCell& cell = touches.cells[column + touches.columns * row];
+            bool edited = everything;
+            for (size_t w = 0; w < cell.objects.size() && w < changed.size() && !edited; w++) {
+                edited = (cell.objects[w] & changed[w]) != 0;
+            }
+            for (size_t k = 0; k < reshaped.size() && !edited; k++) {
+                for (const RayBounds& rays : cell.rays) {
+                    if (reaches_Rays(reshaped[k], rays)) {
+                        edited = true;
+                        break;
+                    }
+                }
+            }
+            if (edited)
+                cells.push_back(cell_Rect(column, row));
+        }
+    }
+    return cells;
+}
+
+unsigned char* render_Edits(Reader* before, Reader* after, const RenderSettings& settings, TouchMap& touches,
+                            const unsigned char* previous, RenderStats* stats, vector<Tile>* changed) {
+    if (touches.cells.empty() || touches.scene != scene_Fingerprint(before))
+        return nullptr;
+
+    // anti-aliasing edges and the denoiser tie the pixels around an edited cell to it
+    int margin = region_Margin(settings);
+    vector<Tile> regions;
+    for (const Tile& cell : edited_Cells(before, after, touches)) {
+        Tile region = { glm::max(cell.x0 - margin, 0), glm::max(cell.y0 - margin, 0),
+                        glm::min(cell.x1 + margin, (int)width), glm::min(cell.y1 + margin, (int)height) };
+        // cells come row by row; runs of them become one region
+        if (!regions.empty() && regions.back().y0 == region.y0 && regions.back().x1 >= region.x0)
+            regions.back().x1 = region.x1;
+        else
+            regions.push_back(region);
+    }
+
+    auto* image = new unsigned char[width * height * 4];
+    std::copy(previous, previous + width * height * 4, image);
+    if (!regions.empty()) {
+        RenderSettings edit = settings;
+        edit.regions = regions;
+        edit.touches = &touches;
+        unsigned char* rendered = rendering(after, edit, stats);
+        merge_Regions(rendered, regions, image);
+        delete[] rendered;
+    }
+    touches.scene = scene_Fingerprint(after);
+    if (changed)
+        *changed = regions;
+    return image;
+}
+
+////////////////////
+// NUMA Placement //
+////////////////////
+
+// node of the worker running on this thread, 0 outside NUMA-aware renders
+thread_local int workerNode = 0;
+
+int numa_Node_Count(const RenderSettings& settings) {
+    int nodes = NumaTopology::System().GetNodeCount();
+    return settings.numaNodes > 0 ? glm::min(settings.numaNodes, nodes) : nodes;
+}
+
+int worker_Count(const RenderSettings& settings) {
+    if (settings.pool)
+        return settings.pool->GetWorkerCount();
+    if (settings.threads > 0)
+        return settings.threads;
+    if (settings.numa) {
+        int cpus = 0;
+        for (int node = 0; node < numa_Node_Count(settings); node++) {
+            cpus += NumaTopology::System().GetCpus(node).size();
+        }
+        return cpus;
+    }
+    return glm::max(1, (int)std::thread::hardware_concurrency());
+}
+
+// the framebuffer is split into one horizontal band of block rows per node
+int band_Node(int y, int nodes) {
+    return (y / FB_BLOCK) * nodes / FB_BLOCKS_Y;
+}
+
+// The first write to a page places it on the writer's node, so a pinned thread per node
+// clears that node's band before any tile is rendered
+void first_Touch(unsigned char* image, int* objectIds, const RenderSettings& settings) {
+    int nodes = numa_Node_Count(settings);
+    vector<std::thread> threads;
+    for (int node = 0; node < nodes; node++) {
+        threads.emplace_back([=]() {
+            NumaTopology::PinCurrentThread(NumaTopology::System().GetCpus(node));
+            for (int y = 0; y < (int)height; y++) {
+                if (band_Node(y, nodes) != node)
+                    continue;
+                if (y % FB_BLOCK == 0)
+                    std::fill_n(&image[pixel_Offset(0, y)], FB_BLOCKS_X * FB_BLOCK_BYTES, 0);
+                if (objectIds)
+                    std::fill_n(&objectIds[y * width], width, -1);
+            }
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+// the copy of scene on the calling worker's node, when the scene is replicated
+Reader* local_Scene(Reader* scene, const RenderSettings& settings) {
+    if (settings.nodeScenes && workerNode < (int)settings.nodeScenes->size())
+        return (*settings.nodeScenes)[workerNode];
+    return scene;
+}
+
+// Parses the scene once per node, each time on a thread pinned to the node, so every copy
+// is allocated in that node's memory
+vector<Reader*> replicate_Scene(const string& sceneFile, const RenderSettings& settings) {
+    vector<Reader*> scenes(numa_Node_Count(settings));
+    vector<std::thread> threads;
+    for (int node = 0; node < (int)scenes.size(); node++) {
+        threads.emplace_back([&, node]() {
+            NumaTopology::PinCurrentThread(NumaTopology::System().GetCpus(node));
+            scenes[node] = new Reader();
+            scenes[node]->parser(sceneFile);
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    return scenes;
+}
+
+// Workers are spread evenly over the nodes and pinned to their node's CPUs. Each node first
+// renders the tiles that start in its own framebuffer band, then helps the other nodes.
+template <typename Task>
+void for_Each_Tile_Numa(const vector<Tile>& tiles, const RenderSettings& settings, Task task, const std::atomic<bool>* cancel) {
+    int nodes = numa_Node_Count(settings);
+    vector<vector<int>> queues(nodes);
+    for (int t = 0; t < (int)tiles.size(); t++) {
+        queues[band_Node(tiles[t].y0, nodes)].push_back(t);
+    }
+    std::unique_ptr<std::atomic<int>[]> nextTile(new std::atomic<int>[nodes]);
+    for (int node = 0; node < nodes; node++) {
+        nextTile[node] = 0;
+    }
+
+    auto worker = [&](int node) {
+        workerNode = node;
+        NumaTopology::PinCurrentThread(NumaTopology::System().GetCpus(node));
+        for (int n = 0; n < nodes; n++) {
+            int queueNode = (node + n) % nodes;
+            const vector<int>& queue = queues[queueNode];
+            for (int q = nextTile[queueNode]++; q < (int)queue.size() && !(cancel && *cancel); q = nextTile[queueNode]++) {
+                task(tiles[queue[q]]);
+            }
+        }
+    };
+
+    // the calling thread is not pinned, so it only waits
+    int workers = worker_Count(settings);
+    vector<std::thread> threads;
+    for (int w = 0; w < workers; w++) {
+        threads.emplace_back(worker, w * nodes / workers);
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+// runs task on every tile, spread over the render workers
+template <typename Task>
+void for_Each_Tile(const vector<Tile>& tiles, const RenderSettings& settings, Task task, const std::atomic<bool>* cancel = nullptr) {
+    if (settings.numa) {
+        for_Each_Tile_Numa(tiles, settings, task, cancel);
+        return;
+    }
+    if (settings.pool) {
+        settings.pool->Run((int)tiles.size(), [&](int t) { task(tiles[t]); }, cancel, settings.priority, settings.jobClock);
+        return;
+    }
+    std::atomic<int> nextTile(0);
+
+    // workers pull tiles until none are left or the render is cancelled
+    auto worker = [&]() {
+        for (int t = nextTile++; t < (int)tiles.size() && !(cancel && *cancel); t = nextTile++) {
+            task(tiles[t]);
+        }
+    };
+
+    vector<std::thread> workers;
+    for (int w = 1; w < worker_Count(settings); w++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
+
+////////////////////////////
+// Cost-Guided Scheduling //
+////////////////////////////
+
+/* Render time measured at one sample pixel per cellSize x cellSize cell of the screen */
+struct CostMap {
+    int cellSize;
+    int columns, rows;
+    vector<double> nanos;
+
+    CostMap(int cellSize)
+        : cellSize(cellSize), columns((width + cellSize - 1) / cellSize), rows((height + cellSize - 1) / cellSize),
+          nanos(columns * rows, 0.0) {}
+
+    // (x, y) must be a sample pixel, so every cell is written by the one worker owning it
+    void add(int x, int y, double pixelNanos) {
+        nanos[x / cellSize + columns * (y / cellSize)] += pixelNanos;
+    }
+
+    // sum of the cells whose sample pixel lies in the tile
+    double cost(const Tile& tile) const {
+        double sum = 0.0;
+        for (int cy = (tile.y0 + cellSize - 1) / cellSize; cy * cellSize < tile.y1; cy++) {
+            for (int cx = (tile.x0 + cellSize - 1) / cellSize; cx * cellSize < tile.x1; cx++) {
+                sum += nanos[cx + columns * cy];
+            }
+        }
+        return sum;
+    }
+};
+
+// still renders time every 8th pixel in x and y (1/64 of the frame) before scheduling
+const int COST_PROBE_STRIDE = 8;
+// a tile is split while it costs more than 1/(TILE_SPLIT_SHARE * workers) of the frame
+const int TILE_SPLIT_SHARE = 8;
+// with this many grid tiles per worker the tail is already short, and the probe (about 1.5%
+// of the frame) would cost more than scheduling saves
+const int BALANCED_TILES_PER_WORKER = 32;
+
+// Traces the sample pixel of every cell and records its time, without writing any buffer
+void probe_Costs(Reader* scene, const RenderSettings& settings, const vector<Tile>& tiles, CostMap& costs) {
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        int stride = costs.cellSize;
+        for (int i = (tile.y0 + stride - 1) / stride * stride; i < tile.y1; i += stride) {
+            for (int j = (tile.x0 + stride - 1) / stride * stride; j < tile.x1; j += stride) {
+                auto start = std::chrono::steady_clock::now();
+                Ray ray = UpdateRay(j, i, nothingSurface(), true, primary_Ray(j, i, scene), scene);
+                GetPixelColor(j, i, ray, 0, scene, settings.maxDepth, settings.shadows);
+                costs.add(j, i, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+    });
+}
+
+// Splits tiles into quarters on cell boundaries while they exceed their share of the frame's
+// cost, then orders them most expensive first, so no worker starts a long tile at the end
+vector<Tile> schedule_Tiles(const vector<Tile>& tiles, const CostMap& costs, int workers) {
+    double total = 0.0;
+    for (const Tile& tile : tiles) {
+        total += costs.cost(tile);
+    }
+    double limit = total / (TILE_SPLIT_SHARE * workers);
+    int cell = costs.cellSize;
+
+    vector<std::pair<double, Tile>> scheduled;
+    vector<Tile> pending(tiles.rbegin(), tiles.rend());
+    while (!pending.empty()) {
+        Tile tile = pending.back();
+        pending.pop_back();
+        double tileCost = costs.cost(tile);
+        int midX = (tile.x0 + tile.x1) / 2 / cell * cell;
+        int midY = (tile.y0 + tile.y1) / 2 / cell * cell;
+        if (tileCost <= limit || midX <= tile.x0 || midY <= tile.y0) {
+            scheduled.push_back({ tileCost, tile });
+            continue;
+        }
+        pending.push_back({ midX, midY, tile.x1, tile.y1 });
+        pending.push_back({ tile.x0, midY, midX, tile.y1 });
+        pending.push_back({ midX, tile.y0, tile.x1, midY });
+        pending.push_back({ tile.x0, tile.y0, midX, midY });
+    }
+
+    std::stable_sort(scheduled.begin(), scheduled.end(), [](const std::pair<double, Tile>& a, const std::pair<double, Tile>& b) {
+        return a.first > b.first;
+    });
+    vector<Tile> ordered;
+    for (const auto& entry : scheduled) {
+        ordered.push_back(entry.second);
+    }
+    return ordered;
+}
+
+/////////////////////////
+// Checkpoint & Resume //
+/////////////////////////
+
+// hash of the eye, objects and lights
+uint64_t hash_Objects(Reader* scene, uint64_t hash) {
+    for (Surface* object : *scene->objects) {
+        int kind[2] = { object->getObjectClass(), object->getType() };
+        vec4 coordinates = object->getCoordinates();
+        vec3 color = object->getColor(vec3(0.25f, 0.25f, 0.0f));  // a plain checkerboard square
+        float shininess = object->getShininess();
+        hash = HashBytes(kind, sizeof(kind), hash);
+        hash = HashBytes(&coordinates, sizeof(vec4), hash);
+        hash = HashBytes(&color, sizeof(vec3), hash);
+        hash = HashBytes(&shininess, sizeof(float), hash);
+    }
+    return hash;
+}
+
+uint64_t scene_Fingerprint(Reader* scene) {
+    uint64_t hash = HashBytes(&scene->eye->coordinates, sizeof(vec3));
+    hash = HashBytes(scene->ambientLight, sizeof(vec4), hash);
+    hash = hash_Objects(scene, hash);
+    for (Light* light : *scene->lights) {
+        hash = HashBytes(&light->type, sizeof(LightType), hash);
+        hash = HashBytes(&light->direction, sizeof(vec3), hash);
+        hash = HashBytes(&light->intensity, sizeof(vec3), hash);
+        if (light->type == SPOTLIGHT) {
+            SpotLight* spotlight = (SpotLight*)light;
+            hash = HashBytes(&spotlight->position_cord, sizeof(vec3), hash);
+            hash = HashBytes(&spotlight->w, sizeof(float), hash);
+        }
+    }
+    return hash;
+}
+
+uint64_t geometry_Fingerprint(Reader* scene) {
+    return hash_Objects(scene, HashBytes(&scene->eye->coordinates, sizeof(vec3)));
+}
+
+// Identifies the scene and every setting that changes pixels, so a checkpoint is never
+// resumed into another render. The engine, packet size and thread count give identical pixels.
+uint64_t render_Fingerprint(Reader* scene, const RenderSettings& settings) {
+    uint64_t hash = scene_Fingerprint(scene);
+    int values[7] = { (int)width, (int)height, settings.tileSize, settings.maxDepth, settings.shadows,
+                      settings.aaMaxSamples, settings.sampleSequence };
+    hash = HashBytes(values, sizeof(values), hash);
+    hash = HashBytes(&settings.aaThreshold, sizeof(float), hash);
+
+    // tiles are saved by their index in the grid, so its order and the regions matter too
+    vector<Tile> tiles = render_Tiles(settings);
+    return HashBytes(tiles.data(), tiles.size() * sizeof(Tile), hash);
+}
+
+// the tile's pixels, row-major, out of a tiled framebuffer
+vector<unsigned char> read_Tile(const unsigned char* framebuffer, const Tile& tile) {
+    vector<unsigned char> pixels;
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            pixels.insert(pixels.end(), &framebuffer[pixel_Offset(j, i)], &framebuffer[pixel_Offset(j, i) + 4]);
+        }
+    }
+    return pixels;
+}
+
+void write_Tile(unsigned char* framebuffer, const Tile& tile, const vector<unsigned char>& pixels) {
+    int tileWidth = tile.x1 - tile.x0;
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            std::copy_n(&pixels[((i - tile.y0) * tileWidth + j - tile.x0) * 4], 4, &framebuffer[pixel_Offset(j, i)]);
+        }
+    }
+}
+
+// Puts a tile saved by a checkpoint back into the target. Its object ids and guides are not
+// saved, so the primary rays are traced again the way the tile renderers trace them.
+void restore_Tile(Reader* scene, const Tile& tile, const RenderSettings& settings, const TileRecord& record, RenderTarget& target) {
+    write_Tile(target.image, tile, record.Traced);
+    if (!target.objectIds && !target.guides)
+        return;
+
+    int tileWidth = tile.x1 - tile.x0;
+    vector<Ray> rays;
+    if (settings.rasterPrimary || settings.packetSize > 0) {
+        if (!trace_Primary(scene, tile, settings, rays))
+            rays.assign(tileWidth * (tile.y1 - tile.y0), Ray(vec3(0, 0, 0), vec3(0, 0, 0)));
+    }
+    else {
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                Ray init_ray(vec3(0, 0, 0), vec3(0, 0, 0));
+                rays.push_back(UpdateRay(j, i, nothingSurface(), false, init_ray, scene));
+            }
+        }
+    }
+    for (int p = 0; p < (int)rays.size(); p++) {
+        record_Primary(target, tile.x0 + p % tileWidth, tile.y0 + p / tileWidth, rays[p]);
+    }
+}
+
+////////////////////////////
+// Adaptive Anti-Aliasing //
+////////////////////////////
+
+// sample dimensions drawn from the Sampler
+const int PIXEL_DIMENSION = 0;  // 2D sub-pixel offset
+
+vec4 sample_Color(int x, int y, vec2 offset, Reader* scene, const RenderSettings& settings, AovSample* lighting = nullptr) {
+    Ray ray = UpdateRay(x, y, nothingSurface(), true, primary_Ray(x, y, scene, offset), scene);
+    touch_Pixel(x, y);
+    touch_Ray(PRIMARY_RAYS, ray);
+    return GetPixelColor(x, y, ray, 0, scene, settings.maxDepth, settings.shadows, nullptr, lighting);
+}
+
+// An edge is an object id change or a colour step above the threshold towards a neighbour
+bool needs_Supersampling(const RenderTarget& target, int x, int y, float threshold) {
+    const int dx[4] = { 1, -1, 0, 0 };
+    const int dy[4] = { 0, 0, 1, -1 };
+    int p = x + width * y;
+    const unsigned char* pixel = &target.image[pixel_Offset(x, y)];
+
+    for (int n = 0; n < 4; n++) {
+        int nx = x + dx[n], ny = y + dy[n];
+        if (nx < 0 || ny < 0 || nx >= (int)width || ny >= (int)height)
+            continue;
+        int q = nx + width * ny;
+        if (target.objectIds[p] != target.objectIds[q])
+            return true;
+        const unsigned char* neighbour = &target.image[pixel_Offset(nx, ny)];
+        for (int c = 0; c < 3; c++) {
+            if (abs(pixel[c] - neighbour[c]) > threshold * 255)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Adds jittered samples to an edge pixel until its mean settles or the cap is reached
+int supersample_Pixel(Reader* scene, RenderTarget& target, int x, int y, const RenderSettings& settings, const Sampler& sampler) {
+    unsigned char* pixel = &target.image[pixel_Offset(x, y)];
+    vec4 sum = vec4(pixel[0], pixel[1], pixel[2], pixel[3]) / 255.0f;
+    float lumaSum = dot(vec3(sum), vec3(0.299f, 0.587f, 0.114f));
+    float lumaSquares = lumaSum * lumaSum;
+    int count = 1;
+    int minSamples = glm::min(4, settings.aaMaxSamples);
+    // the lighting passes hold the first sample's, which the new samples are averaged with
+    bool lightingPasses = wants_Lighting(target);
+    AovSample lightingSum;
+    if (lightingPasses) {
+        if (!target.aovs->direct.empty())
+            lightingSum.direct = target.aovs->direct[x + width * y];
+        if (!target.aovs->reflected.empty())
+            lightingSum.reflected = target.aovs->reflected[x + width * y];
+    }
+
+    while (count < settings.aaMaxSamples) {
+        vec2 offset = sampler.Get2D(x, y, count, PIXEL_DIMENSION) - vec2(0.5f, 0.5f);
+        AovSample lighting;
+        vec4 color = sample_Color(x, y, offset, scene, settings, lightingPasses ? &lighting : nullptr);
+        float luma = dot(vec3(color), vec3(0.299f, 0.587f, 0.114f));
+        sum += color;
+        lightingSum.direct += lighting.direct;
+        lightingSum.reflected += lighting.reflected;
+        lumaSum += luma;
+        lumaSquares += luma * luma;
+        count++;
+
+        // stop once the standard error of the mean is well below the edge contrast
+        if (count >= minSamples) {
+            float mean = lumaSum / count;
+            float variance = glm::max(0.0f, lumaSquares / count - mean * mean);
+            if (sqrt(variance / count) < settings.aaThreshold * 0.25f)
+                break;
+        }
+    }
+    write_Pixel(target.image, x, y, sum / (float)count);
+    if (lightingPasses) {
+        lightingSum.direct /= (float)count;
+        lightingSum.reflected /= (float)count;
+        record_Lighting(target, x, y, lightingSum);
+    }
+    return count - 1;
+}
+
+// Supersamples the edges of a fully rendered target; requires its object ids. Edges are found
+// from the single-sample image, so tiles restored from checkpoint must hold their traced pixels.
+void anti_Alias(Reader* scene, const RenderSettings& settings, RenderTarget& target, const vector<Tile>& tiles,
+                RenderStats* stats, const std::atomic<bool>* cancel = nullptr, Checkpoint* checkpoint = nullptr,
+                const std::function<void(const Tile&)>& tileDone = nullptr) {
+    Sampler sampler(settings.sampleSequence, settings.aaMaxSamples);
+
+    // find every edge before refining, so no worker reads a pixel another one is rewriting
+    vector<unsigned char> edges(width * height);
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                edges[j + width * i] = needs_Supersampling(target, j, i, settings.aaThreshold);
+            }
+        }
+    }, cancel);
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        int t = &tile - tiles.data();
+        TileRecord record;
+        if (checkpoint && checkpoint->Find(t, record) && record.Phase == 2) {
+            write_Tile(target.image, tile, record.Final);
+            if (stats)
+                stats->samples += record.Samples;
+            if (tileDone)
+                tileDone(tile);
+            return;
+        }
+
+        TouchScope touching(settings.touches, local_Scene(scene, settings));
+        long long extraSamples = 0;
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                if (edges[j + width * i])
+                    extraSamples += supersample_Pixel(local_Scene(scene, settings), target, j, i, settings, sampler);
+            }
+        }
+        if (checkpoint) {
+            record.Phase = 2;
+            record.Samples = extraSamples;
+            record.Final = read_Tile(target.image, tile);
+            checkpoint->Complete(t, record);
+        }
+        if (stats)
+            stats->samples += extraSamples;
+        if (tileDone)
+            tileDone(tile);
+    }, cancel);
+}
+
+// The finished framebuffer as a row-major image (delete[] it), denoised and cut to the regions
+unsigned char* resolve_Image(const RenderTarget& target, const vector<Tile>& tiles, const RenderSettings& settings,
+                             const GuideBuffers& guides) {
+    auto* image = new unsigned char[width * height * 4];
+    linearize(target.image, image);
+    if (settings.denoisePasses > 0) {
+        // only the traced pixels need filtering
+        Tile window = region_Bounds(tiles);
+        Denoiser(settings.denoisePasses, worker_Count(settings)).Denoise(image, width, height, guides,
+                                                                          window.x0, window.y0, window.x1, window.y1);
+    }
+    if (!settings.regions.empty())
+        clear_Outside_Regions(image, settings.regions);
+    return image;
+}
+
+// Regions leave pixels untraced, so every requested pass starts at its background value
+void clear_Aovs(AovBuffers& aovs) {
+    std::fill(aovs.depth.begin(), aovs.depth.end(), 0.0f);
+    std::fill(aovs.normal.begin(), aovs.normal.end(), vec3(0, 0, 0));
+    std::fill(aovs.objectId.begin(), aovs.objectId.end(), -1);
+    std::fill(aovs.direct.begin(), aovs.direct.end(), vec3(0, 0, 0));
+    std::fill(aovs.reflected.begin(), aovs.reflected.end(), vec3(0, 0, 0));
+}
+
+// only the recursive engine fills the G-buffer, the touch map and the output passes, and
+// restored checkpoint tiles have none of them
+bool recursive_Only(const RenderSettings& settings) {
+    return settings.gbuffer || settings.touches || settings.aovs;
+}
+
+unsigned char* rendering(Reader* scene, const RenderSettings& settings, RenderStats* stats,
+                         const std::atomic<bool>* cancel, const TileProgress& progress) {
+    // left uninitialised so that first_Touch() decides where the pages live
+    std::unique_ptr<unsigned char[]> framebuffer(new unsigned char[FB_BYTES]);
+    std::unique_ptr<int[]> objectIds(settings.aaMaxSamples > 1 ? new int[width * height] : nullptr);
+    GuideBuffers guides;
+    RenderTarget target;
+    target.image = framebuffer.get();
+    target.objectIds = objectIds.get();
+    if (settings.numa)
+        first_Touch(target.image, target.objectIds, settings);
+    else if (!settings.regions.empty()) {
+        // only the regions are traced; the rest stays black and must not look like an edge
+        std::fill_n(target.image, FB_BYTES, 0);
+        if (target.objectIds)
+            std::fill_n(target.objectIds, width * height, -1);
+    }
+    if (settings.denoisePasses > 0) {
+        guides.Resize(width * height);
+        target.guides = &guides;
+    }
+    if (settings.gbuffer) {
+        settings.gbuffer->texels.assign(width * height, GBuffer::Texel());
+        settings.gbuffer->objectIds.assign(width * height, -1);
+        settings.gbuffer->geometry = geometry_Fingerprint(scene);
+        settings.gbuffer->shadows = settings.shadows;
+        settings.gbuffer->lights.clear();
+        for (Light* light : *scene->lights) {
+            settings.gbuffer->lights.push_back(light_Placement(light));
+        }
+        settings.gbuffer->lightTerms.assign(width * height * scene->lights->size(), GBuffer::LightTerms());
+        target.gbuffer = settings.gbuffer;
+    }
+    if (settings.touches)
+        prepare_Touches(*settings.touches, scene, settings.regions);
+    if (settings.aovs) {
+        clear_Aovs(*settings.aovs);
+        target.aovs = settings.aovs;
+    }
+
+    vector<Tile> tiles = render_Tiles(settings);
+    // checkpoints name tiles by their index in the fixed grid, so they keep the grid order
+    if (settings.costSchedule && settings.checkpointFile.empty() &&
+        (int)tiles.size() < BALANCED_TILES_PER_WORKER * worker_Count(settings)) {
+        auto start = std::chrono::steady_clock::now();
+        CostMap costs(COST_PROBE_STRIDE);
+        probe_Costs(scene, settings, tiles, costs);
+        tiles = schedule_Tiles(tiles, costs, worker_Count(settings));
+        if (stats) {
+            stats->probeNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            stats->scheduledTiles = tiles.size();
+        }
+    }
+
+    // restored tiles would have no G-buffer, touched objects or output passes
+    std::unique_ptr<Checkpoint> checkpoint;
+    if (!settings.checkpointFile.empty() && !recursive_Only(settings)) {
+        checkpoint.reset(new Checkpoint(settings.checkpointFile, render_Fingerprint(scene, settings), settings.checkpointInterval));
+        if (settings.resume && checkpoint->Load())
+            cout << "Resuming " << checkpoint->GetTileCount() << " of " << tiles.size() << " tiles from " << settings.checkpointFile << endl;
+    }
+
+    // the anti-aliasing pass visits every tile a second time
+    int passes = settings.aaMaxSamples > 1 ? 2 : 1;
+    std::atomic<int> tilesDone(0);
+    auto tileDone = [&](const Tile& tile) {
+        int done = ++tilesDone;
+        if (progress)
+            progress(tile, done, (int)tiles.size() * passes);
+    };
+
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        int t = &tile - tiles.data();
+        TileRecord record;
+        if (checkpoint && checkpoint->Find(t, record)) {
+            restore_Tile(local_Scene(scene, settings), tile, settings, record, target);
+            tileDone(tile);
+            return;
+        }
+
+        if (settings.wavefront && !recursive_Only(settings))
+            render_Tile_Wavefront(local_Scene(scene, settings), tile, settings, stats, target);
+        else {
+            TouchScope touching(settings.touches, local_Scene(scene, settings));
+            render_Tile(local_Scene(scene, settings), tile, settings, target);
+        }
+        if (checkpoint) {
+            record.Phase = 1;
+            record.Traced = read_Tile(target.image, tile);
+            checkpoint->Complete(t, record);
+        }
+        tileDone(tile);
+    }, cancel);
+    if (stats) {
+        for (const Tile& tile : tiles) {
+            stats->tracedPixels += (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+        }
+        stats->samples += stats->tracedPixels;
+    }
+
+    if (settings.aaMaxSamples > 1 && !(cancel && *cancel))
+        anti_Alias(scene, settings, target, tiles, stats, cancel, checkpoint.get(), tileDone);
+    // a cancelled render keeps its finished tiles for --resume
+    if (cancel && *cancel) {
+        if (checkpoint)
+            checkpoint->Write();
+        return nullptr;
+    }
+    if (checkpoint)
+        checkpoint->Remove();
+    if (settings.gbuffer && settings.denoisePasses > 0)
+        settings.gbuffer->guides = guides;
+
+    return resolve_Image(target, tiles, settings, guides);
+}
+
+//////////////////////
+// Output Variables //
+//////////////////////
+
+bool request_Aovs(AovBuffers& aovs, const string& list) {
+    std::stringstream names(list);
+    string name;
+    while (std::getline(names, name, ',')) {
+        if (name == "depth")
+            aovs.depth.resize(width * height);
+        else if (name == "normal")
+            aovs.normal.resize(width * height);
+        else if (name == "id")
+            aovs.objectId.resize(width * height);
+        else if (name == "direct")
+            aovs.direct.resize(width * height);
+        else if (name == "reflected")
+            aovs.reflected.resize(width * height);
+        else
+            return false;
+    }
+    return true;
+}
+
+size_t aov_Bytes(const AovBuffers& aovs) {
+    return (aovs.depth.size() + aovs.objectId.size()) * 4 + (aovs.normal.size() + aovs.direct.size() + aovs.reflected.size()) * sizeof(vec3);
+}
+
+////////////////
+// Relighting //
+////////////////
+
+size_t gbuffer_Bytes(const GBuffer& gbuffer) {
+    const GuideBuffers& guides = gbuffer.guides;
+    return gbuffer.texels.size() * sizeof(GBuffer::Texel) + gbuffer.objectIds.size() * sizeof(int)
+         + gbuffer.lights.size() * sizeof(LightPlacement) + gbuffer.lightTerms.size() * sizeof(GBuffer::LightTerms)
+         + guides.Normal.size() * sizeof(vec3) + guides.Depth.size() * sizeof(float)
+         + guides.ObjectId.size() * sizeof(int) + guides.Albedo.size() * sizeof(vec3);
+}
+
+// Shades every pixel from its texel exactly as GetPixelColor() shades an OBJ hit, then
+// anti-aliases (edges depend on the new colours, so they are found again) and denoises.
+// Lights placed as in the captured scene reuse its light factors; only moved or added lights
+// are shaded again and trace shadow rays.
+unsigned char* relight(Reader* scene, const RenderSettings& settings, const GBuffer& gbuffer, RenderStats* stats) {
+    if (gbuffer.texels.size() != width * height || gbuffer.geometry != geometry_Fingerprint(scene))
+        return nullptr;
+
+    // captured light whose factors each light of scene can reuse, -1 for none
+    vector<int> knownLights(scene->lights->size(), -1);
+    for (int k = 0; k < (int)scene->lights->size(); k++) {
+        LightPlacement placement = light_Placement(scene->lights->at(k));
+        for (int captured = 0; captured < (int)gbuffer.lights.size(); captured++) {
+            if (same_Placement(placement, gbuffer.lights[captured]) && gbuffer.shadows == settings.shadows) {
+                knownLights[k] = captured;
+                break;
+            }
+        }
+    }
+
+    std::unique_ptr<unsigned char[]> framebuffer(new unsigned char[FB_BYTES]());
+    vector<int> objectIds(gbuffer.objectIds);
+    RenderTarget target;
+    target.image = framebuffer.get();
+    target.objectIds = settings.aaMaxSamples > 1 ? objectIds.data() : nullptr;
+    vec3 ambientLight(scene->ambientLight->r, scene->ambientLight->g, scene->ambientLight->b);
+
+    vector<Tile> tiles = render_Tiles(settings);
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        vector<const GBuffer::LightTerms*> knownTerms(knownLights.size());
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                const GBuffer::Texel& texel = gbuffer.texels[j + width * i];
+                if (texel.object < 0) {
+                    write_Pixel(target.image, j, i, vec4(texel.albedo, texel.alpha));
+                    continue;
+                }
+                Ray hit(-texel.view, texel.position);
+                hit.setHitPoint(texel.position);
+                hit.setSceneObject(scene->objects->at(texel.object));
+                const GBuffer::LightTerms* pixelTerms = &gbuffer.lightTerms[(j + width * i) * gbuffer.lights.size()];
+                for (int k = 0; k < (int)knownLights.size(); k++) {
+                    knownTerms[k] = knownLights[k] >= 0 ? pixelTerms + knownLights[k] : nullptr;
+                }
+                vec3 color = texel.albedo * ambientLight + direct_Light(hit, texel.albedo, texel.normal, texel.view, scene, settings.shadows,
+                                                                        nullptr, knownTerms.data());
+                color = min(color, vec3(1.0, 1.0, 1.0));
+                color = max(color, vec3(0.0, 0.0, 0.0));
+                write_Pixel(target.image, j, i, vec4(color, 1.0));
+            }
+        }
+    });
+    if (stats) {
+        for (const Tile& tile : tiles) {
+            stats->tracedPixels += (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+        }
+    }
+
+    if (settings.aaMaxSamples > 1)
+        anti_Alias(scene, settings, target, tiles, stats);
+    return resolve_Image(target, tiles, settings, gbuffer.guides);
+}
+
+////////////////////////
+// Shared Worker Pool //
+////////////////////////
+
+long long JobClock::Now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - submitted).count();
+}
+
+float RenderJob::GetProgress() const
+{
+    int count = *m_TileCount;
+    return count > 0 ? (float)*m_TilesDone / count : 0.0f;
+}
+
+RenderJobStats RenderJob::GetStats() const
+{
+    RenderJobStats stats;
+    long long start = m_Clock->startNanos;
+    long long finish = m_Clock->finishNanos;
+    long long end = finish >= 0 ? finish : m_Clock->Now();
+    stats.queueMs = (start >= 0 ? start : end) / 1e6;
+    stats.elapsedMs = end / 1e6;
+    stats.workerMs = m_Clock->workerNanos / 1e6;
+    stats.tiles = m_Clock->tasks;
+    if (start >= 0 && end > start)
+        stats.tilesPerSecond = stats.tiles / ((end - start) / 1e9);
+    return stats;
+}
+
+RenderPool::RenderPool(int workers)
+{
+    if (workers <= 0)
+        workers = glm::max(1, (int)std::thread::hardware_concurrency());
+    for (int w = 0; w < workers; w++)
+        m_Workers.emplace_back(&RenderPool::WorkerLoop, this);
+}
+
+RenderPool::~RenderPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_Lock);
+        m_Stopping = true;
+    }
+    m_Wake.notify_all();
+    for (std::thread& worker : m_Workers)
+        worker.join();
+}
+
+void RenderPool::WorkerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    while (true)
+    {
+        // one task at a time, so a more urgent batch is picked up as soon as a task finishes
+        std::shared_ptr<Batch> batch;
+        m_Wake.wait(lock, [&]() {
+            batch = PickLocked();
+            return batch || (m_Stopping && m_Batches.empty());
+        });
+        if (!batch)
+            return;
+
+        int index = batch->next++;
+        batch->running++;
+        if (batch->clock && batch->clock->startNanos < 0)
+            batch->clock->startNanos = batch->clock->Now();
+        lock.unlock();
+        auto start = std::chrono::steady_clock::now();
+        batch->task(index);
+        long long nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        lock.lock();
+        batch->running--;
+        batch->finished++;
+        batch->serviceNanos += nanos;
+        if (batch->clock)
+        {
+            batch->clock->workerNanos += nanos;
+            batch->clock->tasks++;
+        }
+
+        bool exhausted = batch->next >= batch->count || (batch->cancel && *batch->cancel);
+        if (exhausted && batch->running == 0)
+            FinishLocked(batch);
+    }
+}
+
+std::shared_ptr<RenderPool::Batch> RenderPool::PickLocked()
+{
+    std::shared_ptr<Batch> best;
+    double bestService = 0;
+    for (int b = 0; b < (int)m_Batches.size(); b++)
+    {
+        std::shared_ptr<Batch> candidate = m_Batches[b];
+        if (candidate->next >= candidate->count || (candidate->cancel && *candidate->cancel))
+        {
+            if (candidate->running == 0)
+            {
+                FinishLocked(candidate);  // cancelled before any of its tasks were handed out
+                b--;
+            }
+            continue;
+        }
+        // tasks in flight count at the batch's mean task time, so that idle workers picking
+        // at once spread over the batches instead of all joining the one that was behind
+        double service = candidate->serviceNanos;
+        if (candidate->finished > 0)
+            service += candidate->running * (double)candidate->serviceNanos / candidate->finished;
+        // earlier batches win ties, so equal batches still take turns in queue order
+        if (!best || candidate->priority < best->priority || (candidate->priority == best->priority && service < bestService))
+        {
+            best = candidate;
+            bestService = service;
+        }
+    }
+    return best;
+}
+
+void RenderPool::FinishLocked(const std::shared_ptr<Batch>& batch)
+{
+    if (batch->done)
+        return;
+    batch->done = true;
+    m_Batches.erase(std::find(m_Batches.begin(), m_Batches.end(), batch));
+    m_Finished.notify_all();
+}
+
+void RenderPool::Run(int count, const std::function<void(int)>& task, const std::atomic<bool>* cancel,
+                     RenderPriority priority, JobClock* clock)
+{
+    if (count <= 0)
+        return;
+
+    auto batch = std::make_shared<Batch>();
+    batch->count = count;
+    batch->task = task;
+    batch->cancel = cancel;
+    batch->priority = priority;
+    batch->clock = clock;
+
+    std::unique_lock<std::mutex> lock(m_Lock);
+    // a new batch starts level with the least served one of its class instead of at zero,
+    // which would give it every worker until it had caught up with renders running for long
+    bool first = true;
+    for (const std::shared_ptr<Batch>& queued : m_Batches)
+    {
+        if (queued->priority == priority && (first || queued->serviceNanos < batch->serviceNanos))
+        {
+            batch->serviceNanos = queued->serviceNanos;
+            first = false;
+        }
+    }
+    m_Batches.push_back(batch);
+    m_Wake.notify_all();
+    m_Finished.wait(lock, [&]() { return batch->done; });
+}
+
+RenderJob RenderPool::Submit(Reader* scene, const RenderSettings& settings, const TileProgress& progress)
+{
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    auto tilesDone = std::make_shared<std::atomic<int>>(0);
+    auto tileCount = std::make_shared<std::atomic<int>>(0);
+    auto clock = std::make_shared<JobClock>();
+
+    RenderSettings jobSettings = settings;
+    jobSettings.pool = this;
+    jobSettings.jobClock = clock.get();
+    TileProgress jobProgress = [=](const Tile& tile, int done, int total) {
+        *tilesDone = done;
+        *tileCount = total;
+        if (progress)
+            progress(tile, done, total);
+    };
+
+    // the job's own thread only hands its tiles to the pool and waits for them
+    std::shared_future<vector<unsigned char>> image = std::async(std::launch::async, [=]() {
+        std::unique_ptr<unsigned char[]> pixels(rendering(scene, jobSettings, nullptr, cancel.get(), jobProgress));
+        clock->finishNanos = clock->Now();
+        if (!pixels)
+            return vector<unsigned char>();
+        return vector<unsigned char>(pixels.get(), pixels.get() + width * height * 4);
+    }).share();
+    return RenderJob(image, cancel, tilesDone, tileCount, clock);
+}
+
+/////////////////////////
+// Progressive Preview //
+/////////////////////////
+
+// Traces the pixels whose coordinates are both multiples of stride, except those that are
+// also multiples of skip (already traced by a coarser pass; 0 = skip none). With costs, whose
+// cell size must be stride, the time of every pixel is recorded too.
+void render_Strided(Reader* scene, const RenderSettings& settings, RenderTarget& target, const vector<Tile>& tiles,
+                    int stride, int skip, const std::atomic<bool>* cancel, CostMap* costs = nullptr) {
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        for (int i = (tile.y0 + stride - 1) / stride * stride; i < tile.y1; i += stride) {
+            // rows are short, so a stuck tile still notices cancellation quickly
+            if (cancel && *cancel)
+                return;
+            for (int j = (tile.x0 + stride - 1) / stride * stride; j < tile.x1; j += stride) {
+                if (skip && i % skip == 0 && j % skip == 0)
+                    continue;
+                auto start = std::chrono::steady_clock::now();
+                Ray ray = UpdateRay(j, i, nothingSurface(), true, primary_Ray(j, i, scene), scene);
+                record_Primary(target, j, i, ray);
+                write_Pixel(target.image, j, i, GetPixelColor(j, i, ray, 0, scene, settings.maxDepth, settings.shadows));
+                if (costs)
+                    costs->add(j, i, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+    }, cancel);
+}
+
+// Fills every pixel of the row-major out with the sample at the top-left corner of its
+// stride x stride block in a tiled framebuffer
+void upscale_Preview(const unsigned char* framebuffer, int stride, vector<unsigned char>& out) {
+    out.resize(width * height * 4);
+    if (stride == 1) {
+        linearize(framebuffer, out.data());
+        return;
+    }
+    for (int y = 0; y < (int)height; y++) {
+        for (int x = 0; x < (int)width; x++) {
+            const unsigned char* source = &framebuffer[pixel_Offset(x - x % stride, y - y % stride)];
+            std::copy(source, source + 4, out.begin() + (x + width * y) * 4);
+        }
+    }
+}
+
+void publish_Preview(PreviewFrame* frame, const unsigned char* framebuffer, int stride, const string& pass) {
+    vector<unsigned char> pixels;
+    upscale_Preview(framebuffer, stride, pixels);
+    std::lock_guard<std::mutex> guard(frame->lock);
+    frame->pixels.swap(pixels);
+    frame->pass = pass;
+    frame->version++;
+}
+
+// Traces every 4th pixel in x and y (1/16 of the frame), then every 2nd, then the rest,
+// each pass only adding the pixels earlier passes have not computed, and finally
+// supersamples the edges. A preview is published after every pass. The pixel costs of
+// the first pass schedule the tiles of the later ones.
+void render_Progressive(Reader* scene, const RenderSettings& settings, PreviewFrame* frame) {
+    vector<unsigned char> framebuffer(FB_BYTES);
+    vector<int> objectIds(width * height);
+    RenderTarget target;
+    target.image = framebuffer.data();
+    target.objectIds = objectIds.data();
+    vector<Tile> tiles = make_Tiles(settings.tileSize);
+    CostMap costs(4);
+
+    for (int stride = 4; stride >= 1; stride /= 2) {
+        auto start = std::chrono::steady_clock::now();
+        render_Strided(scene, settings, target, tiles, stride, stride < 4 ? stride * 2 : 0, &frame->cancel,
+                       stride == 4 && settings.costSchedule ? &costs : nullptr);
+        if (frame->cancel)
+            return;
+        if (stride == 4 && settings.costSchedule)
+            tiles = schedule_Tiles(tiles, costs, worker_Count(settings));
+
+        auto end = std::chrono::steady_clock::now();
+        std::ostringstream pass;
+        pass << "1/" << stride * stride << " resolution in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms";
+        publish_Preview(frame, target.image, stride, pass.str());
+    }
+
+    if (settings.aaMaxSamples > 1) {
+        anti_Alias(scene, settings, target, tiles, nullptr, &frame->cancel);
+        if (!frame->cancel)
+            publish_Preview(frame, target.image, 1, "anti-aliased");
+    }
+}
+
+/////////////////////////////
+// Interactive Fly-Through //
+/////////////////////////////
+
+// coarsest resolution a moving frame drops to: every 8th pixel in x and y
+const int MAX_FLY_STRIDE = 8;
+
+void fly_To(FlyThrough* fly, vec3 eye) {
+    {
+        std::lock_guard<std::mutex> guard(fly->lock);
+        fly->eye = vec3(eye.x, eye.y, glm::max(eye.z, 0.01f));
+        fly->moves++;
+        fly->frame.cancel = true;
+    }
+    fly->wake.notify_one();
+}
+
+void stop_Flying(FlyThrough* fly) {
+    {
+        std::lock_guard<std::mutex> guard(fly->lock);
+        fly->stopping = true;
+        fly->frame.cancel = true;
+    }
+    fly->wake.notify_one();
+}
+
+// samples the history of a pixel averages; a still eye has converged once every pixel has them
+const int TEMPORAL_SAMPLES = 8;
+
+/* What every pixel of a temporal fly-through shows, carried from frame to frame */
+struct TemporalHistory {
+    vector<vec3> colors;    // mean of the pixel's samples
+    vector<vec4> points;    // primary hit of the latest sample (w = 1), or its ray direction for a miss (w = 0)
+    vector<int> objectIds;  // primary hit of the latest sample
+    vector<int> samples;    // samples in the mean, 0 if the pixel has no history
+    vector<char> moved;     // the eye moved since the latest sample, so the history may be of another surface
+};
+
+void resize_History(TemporalHistory& history) {
+    history.colors.assign(width * height, vec3(0));
+    history.points.assign(width * height, vec4(0));
+    history.objectIds.assign(width * height, -1);
+    history.samples.assign(width * height, 0);
+    history.moved.assign(width * height, 0);
+}
+
+// Pixel whose centre is nearest to where the line from the eye to point crosses the image
+// plane z = 0, and the point's distance from the eye (infinite for a miss); false if the
+// point is behind the eye or off screen
+bool project_Point(vec4 point, vec3 eye, int& x, int& y, float& depth) {
+    vec3 direction = point.w != 0 ? vec3(point) - eye : vec3(point);
+    if (direction.z >= 0)
+        return false;
+    vec3 onPlane = eye + direction * (-eye.z / direction.z);
+    float pixel = 2.0f / 800.0f;
+    float column = floor((onPlane.x + 1) / pixel);
+    float row = floor((1 - onPlane.y) / pixel);
+    if (column < 0 || row < 0 || column >= width || row >= height)
+        return false;
+    x = (int)column;
+    y = (int)row;
+    depth = point.w != 0 ? length(direction) : INFINITY;
+    return true;
+}
+
+// Moves every pixel of previous to the pixel its point lands on from eye. Where several land
+// on one pixel the nearest wins, and of equally near ones the first in row order, so the
+// result does not depend on the worker count. Pixels nothing lands on have no history.
+void reproject_History(const TemporalHistory& previous, TemporalHistory& current, vec3 eye,
+                       const vector<Tile>& tiles, const RenderSettings& settings) {
+    // depth bits (which order positive floats like their values) above the source pixel
+    std::unique_ptr<std::atomic<uint64_t>[]> nearest(new std::atomic<uint64_t>[width * height]);
+    for (int p = 0; p < (int)(width * height); p++)
+        nearest[p].store(UINT64_MAX, std::memory_order_relaxed);
+
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                int p = j + width * i;
+                int x, y;
+                float depth;
+                if (previous.samples[p] == 0 || !project_Point(previous.points[p], eye, x, y, depth))
+                    continue;
+                uint32_t depthBits;
+                std::memcpy(&depthBits, &depth, sizeof(depthBits));
+                uint64_t key = (uint64_t)depthBits << 32 | (uint32_t)p;
+                std::atomic<uint64_t>& seen = nearest[x + width * y];
+                uint64_t old = seen.load(std::memory_order_relaxed);
+                while (key < old && !seen.compare_exchange_weak(old, key, std::memory_order_relaxed)) {
+                }
+            }
+        }
+    });
+
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                int p = j + width * i;
+                uint64_t key = nearest[p].load(std::memory_order_relaxed);
+                if (key == UINT64_MAX) {
+                    current.samples[p] = 0;
+                    continue;
+                }
+                int source = (int)(key & 0xffffffffu);
+                current.colors[p] = previous.colors[source];
+                current.points[p] = previous.points[source];
+                current.objectIds[p] = previous.objectIds[source];
+                current.samples[p] = previous.samples[source];
+                current.moved[p] = 1;
+            }
+        }
+    });
+}
+
+// Position of the pixel the frame traces in every stride x stride block. Over stride^2
+// consecutive phases it visits every position of the block, alternating the diagonals.
+void pattern_Position(int stride, int phase, int& px, int& py) {
+    phase %= stride * stride;
+    px = phase % stride;
+    py = (phase / stride + phase % stride) % stride;
+}
+
+// Traces one pixel in every stride x stride block (see pattern_Position()), and with traceHoles
+// every pixel without history too, and blends each sample into the pixel's history. After the
+// eye moved, a sample that hits another object, or a point more than 5% nearer or farther,
+// starts the history over (jittered samples of a still eye may differ at edges). Each pixel walks through the sampler's jittered offsets, starting at its centre. Returns the
+// number of pixels traced.
+int trace_Temporal(Reader* scene, const RenderSettings& settings, TemporalHistory& history, const vector<Tile>& tiles,
+                   int stride, int phase, bool traceHoles, const Sampler& sampler) {
+    int px, py;
+    pattern_Position(stride, phase, px, py);
+    vec3 eye = scene->eye->getCoordinates();
+    std::atomic<int> traced{0};
+
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        int tileTraced = 0;
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                int p = j + width * i;
+                int samples = history.samples[p];
+                if (!(j % stride == px && i % stride == py) && !(traceHoles && samples == 0))
+                    continue;
+
+                int index = samples % TEMPORAL_SAMPLES;
+                vec2 offset = index > 0 ? sampler.Get2D(j, i, index, PIXEL_DIMENSION) - vec2(0.5f, 0.5f) : vec2(0, 0);
+                Ray ray = UpdateRay(j, i, nothingSurface(), true, primary_Ray(j, i, scene, offset), scene);
+                vec3 color = vec3(GetPixelColor(j, i, ray, 0, scene, settings.maxDepth, settings.shadows));
+                Surface* object = ray.getSceneObject();
+                vec4 point = object->getType() == NOTHING ? vec4(ray.getRayDirection(), 0) : vec4(ray.getHitPoint(), 1);
+
+                if (samples > 0 && history.moved[p] && object->getId() != history.objectIds[p])
+                    samples = 0;
+                if (samples > 0 && history.moved[p] && point.w != 0) {
+                    float depth = length(vec3(point) - eye);
+                    if (abs(length(vec3(history.points[p]) - eye) - depth) > 0.05f * depth)
+                        samples = 0;
+                }
+                // past TEMPORAL_SAMPLES the mean turns into a moving average
+                float weight = 1.0f / glm::min(samples + 1, TEMPORAL_SAMPLES);
+                history.colors[p] = samples > 0 ? mix(history.colors[p], color, weight) : color;
+                history.points[p] = point;
+                history.objectIds[p] = object->getId();
+                history.samples[p] = samples + 1;
+                history.moved[p] = 0;
+                tileTraced++;
+            }
+        }
+        traced += tileTraced;
+    });
+    return traced;
+}
+
+// Writes the history into a tiled framebuffer. A pixel without history shows the pixel traced
+// in its stride x stride block, if that one has any.
+void show_History(const TemporalHistory& history, unsigned char* framebuffer, int stride, int phase,
+                  const vector<Tile>& tiles, const RenderSettings& settings) {
+    int px, py;
+    pattern_Position(stride, phase, px, py);
+    for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                int p = j + width * i;
+                if (history.samples[p] == 0) {
+                    int x = glm::min(j - j % stride + px, (int)width - 1);
+                    int y = glm::min(i - i % stride + py, (int)height - 1);
+                    p = x + width * y;
+                }
+                write_Pixel(framebuffer, j, i, vec4(history.samples[p] > 0 ? history.colors[p] : vec3(0), 1));
+            }
+        }
+    });
+}
+
+// render_Interactive() with fly->temporal
+void render_Temporal(Reader* scene, const RenderSettings& settings, FlyThrough* fly) {
+    vector<unsigned char> framebuffer(FB_BYTES);
+    vector<Tile> tiles = make_Tiles(settings.tileSize);
+    Sampler sampler(settings.sampleSequence, TEMPORAL_SAMPLES);
+    TemporalHistory history, reprojected;
+    resize_History(history);
+    resize_History(reprojected);
+    const int pixels = width * height;
+
+    double msPerPixel = 0;  // of the traced pixels, 0 until the first frame is measured
+    double overheadMs = 0;  // of the latest frame, spent on everything but tracing
+    int shownMoves = -1;
+    int phase = 0;
+    bool converged = false;  // every pixel has TEMPORAL_SAMPLES samples for the current eye
+    while (true) {
+        vec3 eye;
+        {
+            std::unique_lock<std::mutex> guard(fly->lock);
+            if (converged)
+                fly->wake.wait(guard, [&]() { return fly->stopping || fly->moves != shownMoves; });
+            if (fly->stopping)
+                return;
+            eye = fly->eye;
+            shownMoves = fly->moves;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (eye != scene->eye->getCoordinates()) {
+            reproject_History(history, reprojected, eye, tiles, settings);
+            std::swap(history, reprojected);
+            scene->eye->coordinates = eye;
+        }
+        int holes = (int)std::count(history.samples.begin(), history.samples.end(), 0);
+
+        // the densest pattern expected to fit the frame time, with the holes if they fit too;
+        // the first frame starts coarse
+        double budget = fly->targetMs - overheadMs;
+        auto frameCost = [&](int stride, bool traceHoles) {
+            int traced = traceHoles ? holes + (pixels - holes) / (stride * stride) : pixels / (stride * stride);
+            return msPerPixel * traced;
+        };
+        bool traceHoles = msPerPixel > 0 && frameCost(MAX_FLY_STRIDE, true) <= budget;
+        int stride = MAX_FLY_STRIDE;
+        while (msPerPixel > 0 && stride > 1 && frameCost(stride - 1, traceHoles) <= budget)
+            stride--;
+
+        auto traceStart = std::chrono::steady_clock::now();
+        int traced = trace_Temporal(scene, settings, history, tiles, stride, phase, traceHoles, sampler);
+        double traceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - traceStart).count();
+        if (traced > 0) {
+            double measured = traceMs / traced;
+            msPerPixel = msPerPixel > 0 ? 0.5 * msPerPixel + 0.5 * measured : measured;
+        }
+        show_History(history, framebuffer.data(), stride, phase, tiles, settings);
+        phase++;
+        converged = std::all_of(history.samples.begin(), history.samples.end(),
+                                [](int samples) { return samples >= TEMPORAL_SAMPLES; });
+        double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        overheadMs = frameMs - traceMs;
+        std::ostringstream pass;
+        if (converged)
+            pass << TEMPORAL_SAMPLES << " samples per pixel";
+        else
+            pass << "traced " << 100.0 * traced / pixels << "% of the pixels";
+        pass << " in " << frameMs << " ms";
+        publish_Preview(&fly->frame, framebuffer.data(), 1, pass.str());
+    }
+}
+
+void render_Interactive(Reader* scene, const RenderSettings& settings, FlyThrough* fly) {
+    // the eye moves, so the per-node copies of the scene would go stale
+    RenderSettings flySettings = settings;
+    flySettings.nodeScenes = nullptr;
+    if (fly->temporal) {
+        render_Temporal(scene, flySettings, fly);
+        return;
+    }
+
+    vector<unsigned char> framebuffer(FB_BYTES);
+    RenderTarget target;
+    target.image = framebuffer.data();
+    vector<Tile> tiles = make_Tiles(flySettings.tileSize);
+
+    double msPerPixel = 0;  // of the moving frames, 0 until the first one is measured
+    int shownMoves = -1;
+    bool sharp = false;     // the latest frame is the full render of the current eye
+    while (true) {
+        int moves;
+        {
+            std::unique_lock<std::mutex> guard(fly->lock);
+            auto moved = [&]() { return fly->stopping || fly->moves != shownMoves; };
+            // the eye counts as stopped after a frame time without moves
+            if (sharp)
+                fly->wake.wait(guard, moved);
+            else
+                fly->wake.wait_for(guard, std::chrono::duration<double, std::milli>(fly->targetMs), moved);
+            if (fly->stopping)
+                return;
+            scene->eye->coordinates = fly->eye;
+            moves = fly->moves;
+            fly->frame.cancel = false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::ostringstream pass;
+        if (moves == shownMoves) {
+            // the eye stopped: replace the last moving frame with the full render
+            std::unique_ptr<unsigned char[]> image(rendering(scene, flySettings, nullptr, &fly->frame.cancel));
+            if (!image)
+                continue;
+            pass << "full resolution in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms";
+            std::lock_guard<std::mutex> guard(fly->frame.lock);
+            fly->frame.pixels.assign(image.get(), image.get() + width * height * 4);
+            fly->frame.pass = pass.str();
+            fly->frame.version++;
+            sharp = true;
+            continue;
+        }
+
+        // the finest resolution expected to fit the frame time; the first frame starts coarse
+        int stride = MAX_FLY_STRIDE;
+        while (msPerPixel > 0 && stride > 1 &&
+               msPerPixel * (width * height) / ((stride - 1) * (stride - 1)) <= fly->targetMs)
+            stride--;
+        render_Strided(scene, flySettings, target, tiles, stride, 0, nullptr);
+        double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        double measured = frameMs * stride * stride / (width * height);
+        msPerPixel = msPerPixel > 0 ? 0.5 * msPerPixel + 0.5 * measured : measured;
+
+        pass << "1/" << stride * stride << " resolution in " << frameMs << " ms";
+        publish_Preview(&fly->frame, target.image, stride, pass.str());
+        shownMoves = moves;
+        sharp = false;
+    }
+}
+
+/////////////////////////////
+// Time-Budgeted Rendering //
+/////////////////////////////
+
+const QualityLevel QUALITY_LEVELS[] = {
+    { 4, 1, false, 1, "1/16 resolution, depth 1, no shadows" },
+    { 2, 2, true, 1, "1/4 resolution, depth 2" },
+    { 1, 3, true, 1, "full resolution, depth 3" },
+    { 1, 5, true, 1, "full resolution, depth 5" },
+    { 1, 5, true, 4, "full resolution, depth 5, up to 4 AA samples" },
+    { 1, 5, true, 16, "full resolution, depth 5, up to 16 AA samples" }
+};
+const int QUALITY_LEVEL_COUNT = sizeof(QUALITY_LEVELS) / sizeof(QualityLevel);
+
+// Rough relative cost of a level in full-quality pixels; the time per unit is measured
+// by the probe and re-measured after every finished level
+double level_Cost(const QualityLevel& level) {
+    double pixels = (double)(width * height) / (level.stride * level.stride);
+    double shading = (level.shadows ? 1.0 : 0.5) * (0.5 + 0.1 * level.maxDepth);
+    double antiAliasing = 1.0 + 0.1 * (level.aaSamples - 1);  // only edge pixels get extra samples
+    return pixels * shading * antiAliasing;
+}
+
+RenderSettings level_Settings(const RenderSettings& settings, const QualityLevel& level) {
+    RenderSettings levelSettings = settings;
+    levelSettings.maxDepth = glm::min(level.maxDepth, settings.maxDepth);
+    levelSettings.shadows = level.shadows && settings.shadows;
+    levelSettings.aaMaxSamples = level.aaSamples;
+    return levelSettings;
+}
+
+// Probes the scene on a sparse grid, starts at the best level the probe says fits and keeps
+// stepping up the ladder while the next level is expected to finish. A watchdog cancels the
+// level in flight at the deadline, so a slow tile or pixel only loses that level's work.
+BudgetResult render_Budgeted(Reader* scene, const RenderSettings& settings, double budgetMs) {
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::microseconds((long long)(budgetMs * 1000));
+    auto remainingMs = [&]() { return std::chrono::duration<double, std::milli>(deadline - Clock::now()).count(); };
+
+    BudgetResult result;
+    result.image.assign(width * height * 4, 0);
+
+    std::atomic<bool> cancel(false);
+    std::mutex watchdogLock;
+    std::condition_variable watchdogWake;
+    bool finished = false;
+    std::thread watchdog([&]() {
+        std::unique_lock<std::mutex> guard(watchdogLock);
+        if (!watchdogWake.wait_until(guard, deadline, [&]() { return finished; }))
+            cancel = true;
+    });
+
+    vector<unsigned char> framebuffer(FB_BYTES);
+    vector<int> objectIds(width * height);
+    RenderTarget target;
+    target.image = framebuffer.data();
+    target.objectIds = objectIds.data();
+    vector<Tile> tiles = make_Tiles(settings.tileSize);
+
+    // probe: every 16th pixel at the highest depth and with shadows
+    const int probeStride = 16;
+    QualityLevel probe = { probeStride, 5, true, 1, "probe" };
+    auto probeStart = Clock::now();
+    CostMap costs(probeStride);
+    render_Strided(scene, level_Settings(settings, probe), target, tiles, probeStride, 0, &cancel, &costs);
+    double msPerUnit = std::chrono::duration<double, std::milli>(Clock::now() - probeStart).count() / level_Cost(probe);
+    if (settings.costSchedule)
+        tiles = schedule_Tiles(tiles, costs, worker_Count(settings));
+
+    int level = 0;
+    while (level + 1 < QUALITY_LEVEL_COUNT && level_Cost(QUALITY_LEVELS[level + 1]) * msPerUnit < remainingMs())
+        level++;
+
+    for (; level < QUALITY_LEVEL_COUNT && !cancel; level++) {
+        const QualityLevel& quality = QUALITY_LEVELS[level];
+        if (result.level >= 0 && level_Cost(quality) * msPerUnit > remainingMs())
+            break;
+
+        RenderSettings levelSettings = level_Settings(settings, quality);
+        auto levelStart = Clock::now();
+        render_Strided(scene, levelSettings, target, tiles, quality.stride, 0, &cancel);
+        if (!cancel && quality.aaSamples > 1)
+            anti_Alias(scene, levelSettings, target, tiles, nullptr, &cancel);
+        if (cancel)
+            break;
+
+        upscale_Preview(target.image, quality.stride, result.image);
+        result.level = level;
+        msPerUnit = std::chrono::duration<double, std::milli>(Clock::now() - levelStart).count() / level_Cost(quality);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(watchdogLock);
+        finished = true;
+    }
+    watchdogWake.notify_one();
+    watchdog.join();
+
+    result.elapsedMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return result;
+}
+
+
+/////////////////////////
+// Animation Sequences //
+/////////////////////////
+
+ScenePose scene_Pose(Reader* scene) {
+    ScenePose pose;
+    pose.eye = scene->eye->getCoordinates();
+    for (Light* light : *scene->lights) {
+        pose.lightDirections.push_back(light->direction);
+        pose.lightPositions.push_back(light->type == SPOTLIGHT ? ((SpotLight*)light)->getPosition() : vec3(0, 0, 0));
+    }
+    for (Surface* object : *scene->objects) {
+        pose.objects.push_back(object->getCoordinates());
+    }
+    return pose;
+}
+
+int sequence_Length(Reader* scene) {
+    int frames = 1;
+    for (const Keyframe& key : *scene->keyframes) {
+        frames = glm::max(frames, key.frame + 1);
+    }
+    return frames;
+}
+
+// The track's pose at frame, interpolated between the keyframes around it; false if the track
+// has no keyframes
+bool track_Pose(const vector<Keyframe>& keyframes, char track, int index, int frame, Keyframe& pose) {
+    const Keyframe* before = nullptr;
+    const Keyframe* after = nullptr;
+    for (const Keyframe& key : keyframes) {
+        if (key.track != track || key.index != index)
+            continue;
+        if (key.frame <= frame && (!before || key.frame >= before->frame))
+            before = &key;
+        if (key.frame >= frame && (!after || key.frame < after->frame))
+            after = &key;
+    }
+    if (!before && !after)
+        return false;
+    if (!before || !after || before->frame == after->frame) {
+        pose = before ? *before : *after;
+        return true;
+    }
+    float t = float(frame - before->frame) / (after->frame - before->frame);
+    pose = *before;
+    pose.translation = mix(before->translation, after->translation, t);
+    pose.yaw = glm::mix(before->yaw, after->yaw, t);
+    return true;
+}
+
+// v turned by degrees around the vertical axis, counter-clockwise seen from above
+vec3 turn_Yaw(vec3 v, float degrees) {
+    float angle = glm::radians(degrees);
+    return vec3(cos(angle) * v.x + sin(angle) * v.z, v.y, -sin(angle) * v.x + cos(angle) * v.z);
+}
+
+void pose_Frame(Reader* scene, const ScenePose& rest, int frame) {
+    const vector<Keyframe>& keyframes = *scene->keyframes;
+    Keyframe pose;
+    scene->eye->coordinates = track_Pose(keyframes, 'v', 0, frame, pose) ? pose.translation : rest.eye;
+
+    for (int l = 0; l < (int)scene->lights->size(); l++) {
+        Light* light = scene->lights->at(l);
+        bool moved = track_Pose(keyframes, 'l', l, frame, pose);
+        light->direction = moved ? turn_Yaw(rest.lightDirections[l], pose.yaw) : rest.lightDirections[l];
+        if (light->type == SPOTLIGHT) {
+            vec3 position = moved ? turn_Yaw(rest.lightPositions[l], pose.yaw) + pose.translation : rest.lightPositions[l];
+            ((SpotLight*)light)->setPosition(position.x, position.y, position.z);
+        }
+    }
+
+    for (int o = 0; o < (int)scene->objects->size(); o++) {
+        Surface* object = scene->objects->at(o);
+        vec4 coordinates = rest.objects[o];
+        if (!track_Pose(keyframes, 'm', o, frame, pose))
+            object->setCoordinates(coordinates);
+        else if (object->getObjectClass() == SPHERE)
+            object->setCoordinates(vec4(turn_Yaw(vec3(coordinates), pose.yaw) + pose.translation, coordinates.w));
+        else {
+            // n.x + d = 0 turns with its normal; moving it by t takes n.t off d
+            vec3 normal = turn_Yaw(vec3(coordinates), pose.yaw);
+            object->setCoordinates(vec4(normal, coordinates.w - dot(normal, pose.translation)));
+        }
+    }
+}
+
+// A width x height RGBA image as one frame of the format
+vector<unsigned char> video_Frame(const unsigned char* image, VideoFormat format) {
+    vector<unsigned char> frame;
+    if (format == RAW_RGB_VIDEO) {
+        frame.resize(width * height * 3);
+        for (int p = 0; p < (int)(width * height); p++) {
+            std::copy(image + p * 4, image + p * 4 + 3, frame.begin() + p * 3);
+        }
+        return frame;
+    }
+
+    // full-range BT.601 luma per pixel, chroma per 2x2 block
+    const char header[] = "FRAME\n";
+    frame.assign(header, header + sizeof(header) - 1);
+    size_t luma = frame.size();
+    size_t chroma = luma + width * height;
+    frame.resize(chroma + 2 * (width / 2) * (height / 2));
+    auto byte = [](float value) { return (unsigned char)glm::clamp(value + 0.5f, 0.0f, 255.0f); };
+    for (int y = 0; y < (int)height; y++) {
+        for (int x = 0; x < (int)width; x++) {
+            const unsigned char* pixel = &image[(x + width * y) * 4];
+            frame[luma + x + width * y] = byte(0.299f * pixel[0] + 0.587f * pixel[1] + 0.114f * pixel[2]);
+        }
+    }
+    for (int y = 0; y < (int)height / 2; y++) {
+        for (int x = 0; x < (int)width / 2; x++) {
+            vec3 rgb(0, 0, 0);
+            for (int corner = 0; corner < 4; corner++) {
+                const unsigned char* pixel = &image[((2 * x + corner % 2) + width * (2 * y + corner / 2)) * 4];
+                rgb += vec3(pixel[0], pixel[1], pixel[2]) * 0.25f;
+            }
+            int c = x + (width / 2) * y;
+            frame[chroma + c] = byte(128 - 0.168736f * rgb.r - 0.331264f * rgb.g + 0.5f * rgb.b);
+            frame[chroma + (width / 2) * (height / 2) + c] = byte(128 + 0.5f * rgb.r - 0.418688f * rgb.g - 0.081312f * rgb.b);
+        }
+    }
+    return frame;
+}
+
+bool render_Sequence(Reader* scene, const RenderSettings& settings, int frames, int fps, VideoFormat format,
+                     FILE* out, std::ostream& log) {
+    // the scene moves from frame to frame, so the per-node copies would go stale
+    RenderSettings frameSettings = settings;
+    frameSettings.nodeScenes = nullptr;
+    ScenePose rest = scene_Pose(scene);
+
+    if (format == Y4M_VIDEO && fprintf(out, "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C420jpeg\n", width, height, fps) < 0)
+        return false;
+
+    auto sequenceStart = std::chrono::steady_clock::now();
+    std::future<bool> writing;  // of the previous frame, converted and written while the next one renders
+    bool written = true;
+    for (int frame = 0; frame < frames && written; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        pose_Frame(scene, rest, frame);
+        std::shared_ptr<unsigned char> image(rendering(scene, frameSettings), std::default_delete<unsigned char[]>());
+        auto rendered = std::chrono::steady_clock::now();
+        if (writing.valid())
+            written = writing.get();
+        auto waited = std::chrono::steady_clock::now();
+        writing = std::async(std::launch::async, [image, format, out]() {
+            vector<unsigned char> bytes = video_Frame(image.get(), format);
+            return fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size() && fflush(out) == 0;
+        });
+
+        log << "Frame " << frame + 1 << "/" << frames << ": rendered in "
+            << std::chrono::duration<double, std::milli>(rendered - start).count() << " ms, waited "
+            << std::chrono::duration<double, std::milli>(waited - rendered).count() << " ms for the previous write, image hash "
+            << hash_String(image_Hash(image.get())) << std::endl;
+    }
+    if (writing.valid())
+        written = writing.get() && written;
+
+    double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sequenceStart).count();
+    log << "Streamed " << frames << " frames in " << totalMs << " ms (" << frames * 1000.0 / totalMs << " frames per second)" << std::endl;
+    return written;
+}
+
+///////////////////////
+// Determinism Check //
+///////////////////////
+
+// Every pixel depends only on its coordinates and sample index (the Sampler hashes both),
+// workers never accumulate floats across pixels and the counters are integers, so an image
+// must not change with the number of workers or the order in which tiles finish.
+// Time-budgeted renders are the exception: the level they reach depends on the clock.
+const int DETERMINISM_THREAD_COUNTS[] = { 1, 2, 3, 8 };
+const int DETERMINISM_RUN_COUNT = sizeof(DETERMINISM_THREAD_COUNTS) / sizeof(int);
+
+string hash_String(uint64_t hash) {
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+    return text;
+}
+
+uint64_t image_Hash(const unsigned char* image) {
+    return HashBytes(image, width * height * 4);
+}
+
+// res/Scenes/scene1.txt, scene2.txt, ... up to the first one that is missing
+vector<string> bundled_Scenes() {
+    vector<string> scenes;
+    for (int n = 1; ; n++) {
+        string sceneFile = "res/Scenes/scene" + std::to_string(n) + ".txt";
+        if (!ifstream(sceneFile))
+            break;
+        scenes.push_back(sceneFile);
+    }
+    return scenes;
+}
+
+// Renders each scene once per worker count, then again with the first count, and compares
+// the image hashes. Returns the number of scenes whose images differ.
+int determinism_Check(const vector<string>& sceneFiles, const RenderSettings& settings) {
+    int failures = 0;
+    for (const string& sceneFile : sceneFiles) {
+        Reader scene;
+        scene.parser(sceneFile);
+
+        std::ostringstream report;
+        bool identical = true;
+        uint64_t firstHash = 0;
+        for (int run = 0; run <= DETERMINISM_RUN_COUNT; run++) {
+            RenderSettings runSettings = settings;
+            runSettings.threads = DETERMINISM_THREAD_COUNTS[run % DETERMINISM_RUN_COUNT];
+            runSettings.checkpointFile.clear();
+            unsigned char* image = rendering(&scene, runSettings);
+            uint64_t hash = image_Hash(image);
+            delete[] image;
+
+            if (run == 0)
+                firstHash = hash;
+            identical = identical && hash == firstHash;
+            report << (run == 0 ? " " : ", ") << "threads " << runSettings.threads
+                   << (run == DETERMINISM_RUN_COUNT ? " again " : " ") << hash_String(hash);
+        }
+
+        std::cout << sceneFile << ":" << report.str() << (identical ? " OK" : " MISMATCH") << std::endl;
+        if (!identical)
+            failures++;
+    }
+    return failures;
+}
+
+
+////////////////////
+// NUMA Benchmark //
+////////////////////
+
+// Renders on the first 1, 2, ... nodes with every CPU of those nodes and reports how the
+// throughput scales with the node count; each count keeps the best of three runs
+void numa_Benchmark(Reader* scene, const string& sceneFile, const RenderSettings& settings, bool replicate) {
+    const NumaTopology& topology = NumaTopology::System();
+    if (topology.GetNodeCount() == 1)
+        std::cout << "Only one NUMA node found, scaling across nodes cannot be measured" << std::endl;
+
+    double baseline = 0.0;
+    for (int nodes = 1; nodes <= topology.GetNodeCount(); nodes++) {
+        RenderSettings nodeSettings = settings;
+        nodeSettings.numa = true;
+        nodeSettings.numaNodes = nodes;
+        nodeSettings.threads = 0;
+        nodeSettings.checkpointFile.clear();
+        vector<Reader*> scenes;
+        if (replicate) {
+            scenes = replicate_Scene(sceneFile, nodeSettings);
+            nodeSettings.nodeScenes = &scenes;
+        }
+
+        double bestMs = 0.0;
+        for (int run = 0; run < 3; run++) {
+            auto start = std::chrono::steady_clock::now();
+            delete[] rendering(scene, nodeSettings);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (run == 0 || ms < bestMs)
+                bestMs = ms;
+        }
+
+        double megapixels = width * height / 1e6 / (bestMs / 1000.0);
+        if (nodes == 1)
+            baseline = megapixels;
+        std::cout << nodes << (nodes == 1 ? " node, " : " nodes, ") << worker_Count(nodeSettings) << " workers: "
+                  << bestMs << " ms, " << megapixels << " Mpixel/s, " << megapixels / baseline << "x" << std::endl;
+    }
+}
+
+
+/////////////////
+// Auto-Tuning //
+/////////////////
+
+const int TUNING_TILE_SIZES[] = { 16, 32, 64 };
+const int TUNING_PACKET_SIZES[] = { 0, 4, 8, 16 };
+// Calibration renders cover the 64x64 blocks with even block coordinates: a quarter of the
+// frame spread over all of it, split into whole tiles by every candidate tile size
+const int CALIBRATION_BLOCK = 64;
+
+// best of two first-sample renders of the calibration blocks, in ms
+double calibration_Ms(Reader* scene, const RenderSettings& settings) {
+    vector<Tile> tiles;
+    for (const Tile& tile : make_Tiles(settings.tileSize)) {
+        if ((tile.x0 / CALIBRATION_BLOCK) % 2 == 0 && (tile.y0 / CALIBRATION_BLOCK) % 2 == 0)
+            tiles.push_back(tile);
+    }
+    vector<unsigned char> framebuffer(FB_BYTES);
+    RenderTarget target;
+    target.image = framebuffer.data();
+
+    double bestMs = 0.0;
+    for (int run = 0; run < 2; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for_Each_Tile(tiles, settings, [&](const Tile& tile) {
+            if (settings.wavefront)
+                render_Tile_Wavefront(scene, tile, settings, nullptr, target);
+            else
+                render_Tile(scene, tile, settings, target);
+        });
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || ms < bestMs)
+            bestMs = ms;
+    }
+    return bestMs;
+}
+
+TunedSettings tuned_Settings(const RenderSettings& settings) {
+    TunedSettings tuned;
+    tuned.TileSize = settings.tileSize;
+    tuned.PacketSize = settings.packetSize;
+    tuned.Threads = settings.threads;
+    tuned.Wavefront = settings.wavefront;
+    tuned.SortSecondary = settings.sortSecondary;
+    return tuned;
+}
+
+string describe_Tuning(const RenderSettings& settings) {
+    std::ostringstream text;
+    text << (settings.wavefront ? (settings.sortSecondary ? "sorted wavefront" : "wavefront") : "recursive")
+         << " engine, tile " << settings.tileSize << ", packet " << settings.packetSize
+         << ", " << worker_Count(settings) << " workers";
+    return text.str();
+}
+
+// Searches one parameter at a time, keeping the fastest value before moving on: the engine,
+// then the packet size, the tile size and the worker count. A full grid would need
+// 3 * 4 * 3 * 3 calibration renders instead of 13.
+RenderSettings autotune(Reader* scene, const RenderSettings& settings) {
+    RenderSettings best = settings;
+    best.threads = worker_Count(settings);
+    double bestMs = calibration_Ms(scene, best);
+    std::cout << "Autotune: " << describe_Tuning(best) << ": " << bestMs << " ms" << std::endl;
+
+    auto tryCandidate = [&](RenderSettings candidate) {
+        double ms = calibration_Ms(scene, candidate);
+        std::cout << "Autotune: " << describe_Tuning(candidate) << ": " << ms << " ms" << std::endl;
+        if (ms < bestMs) {
+            bestMs = ms;
+            best = candidate;
+        }
+    };
+
+    RenderSettings engine = best;
+    for (int e = 0; e < 3; e++) {
+        RenderSettings candidate = engine;
+        candidate.wavefront = e > 0;
+        candidate.sortSecondary = e > 1;
+        if (candidate.wavefront != engine.wavefront || candidate.sortSecondary != engine.sortSecondary)
+            tryCandidate(candidate);
+    }
+    RenderSettings packet = best;
+    for (int packetSize : TUNING_PACKET_SIZES) {
+        RenderSettings candidate = packet;
+        candidate.packetSize = packetSize;
+        if (packetSize != packet.packetSize)
+            tryCandidate(candidate);
+    }
+    RenderSettings tile = best;
+    for (int tileSize : TUNING_TILE_SIZES) {
+        RenderSettings candidate = tile;
+        candidate.tileSize = tileSize;
+        if (tileSize != tile.tileSize)
+            tryCandidate(candidate);
+    }
+    // fewer workers than hardware threads can win when SMT siblings share one core
+    int hardwareThreads = glm::max(1, (int)std::thread::hardware_concurrency());
+    RenderSettings threads = best;
+    for (int workers : { glm::max(1, hardwareThreads / 2), hardwareThreads, hardwareThreads * 2 }) {
+        RenderSettings candidate = threads;
+        candidate.threads = workers;
+        if (workers != threads.threads)
+            tryCandidate(candidate);
+    }
+
+    std::cout << "Autotune picked " << describe_Tuning(best) << " (" << bestMs << " ms)" << std::endl;
+    return best;
+}
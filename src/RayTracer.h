@@ -0,0 +1,464 @@
+#pragma once
+
+#include <Reader.h>
+#include <Denoiser.h>
+#include <Sampler.h>
+#include <TuningCache.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Image size */
+const unsigned int width = 800;
+const unsigned int height = 800;
+
+class RenderPool;
+struct JobClock;
+struct GBuffer;
+struct TouchMap;
+struct AovBuffers;
+
+/* Scheduling class of a render's tiles on a RenderPool; a lower class is always served first */
+enum RenderPriority {
+    INTERACTIVE_PRIORITY,  // previews someone is waiting for
+    NORMAL_PRIORITY,       // final renders
+    BACKGROUND_PRIORITY    // thumbnails and other work that can wait
+};
+
+/* Screen-space tile [x0, x1) x [y0, y1) */
+struct Tile {
+    int x0, y0, x1, y1;
+};
+
+/* Render settings */
+struct RenderSettings {
+    bool wavefront = false;  // iterative wavefront engine instead of recursive GetPixelColor
+    int tileSize = 32;
+    int packetSize = 8;      // primary rays are traced in packetSize x packetSize packets, 0 = one at a time
+    bool rasterPrimary = false;  // rasterize primary visibility instead of tracing it; ignores packetSize
+    int threads = 0;         // 0 = one worker per hardware thread
+    bool sortSecondary = false;  // wavefront: trace secondary rays in origin/direction order
+    int aaMaxSamples = 1;        // adaptive anti-aliasing sample cap per pixel, 1 = off
+    float aaThreshold = 0.1f;    // colour contrast against a neighbour that triggers supersampling
+    SampleSequence sampleSequence = SOBOL;  // sub-pixel sample positions
+    int denoisePasses = 0;       // a-trous filter passes after rendering, 0 = off
+    int maxDepth = 5;            // reflection/refraction bounces before a path is cut off
+    bool shadows = true;         // trace shadow rays; without them every light is visible
+    std::string checkpointFile;  // finished tiles are saved here, empty = no checkpoints
+    double checkpointInterval = 10.0;  // seconds between checkpoint writes
+    bool resume = false;         // skip the tiles already saved in checkpointFile
+    bool costSchedule = true;    // probe tile costs, split expensive tiles and render them first
+    bool numa = false;           // pin workers to NUMA nodes and give each node a framebuffer band
+    int numaNodes = 0;           // nodes to render on, 0 = all
+    const std::vector<Reader*>* nodeScenes = nullptr;  // a copy of the scene per node, nullptr = shared
+    RenderPool* pool = nullptr;  // shared workers that run the tiles, nullptr = threads of its own
+    RenderPriority priority = NORMAL_PRIORITY;  // class of the tiles on the pool
+    JobClock* jobClock = nullptr;  // scheduling counters of the pool job, set by RenderPool::Submit()
+    std::vector<Tile> regions;   // pixel rectangles to render, the rest of the frame stays black; empty = all
+    GBuffer* gbuffer = nullptr;  // filled for relight(); the render then uses the recursive engine and no checkpoint
+    TouchMap* touches = nullptr; // filled for render_Edits(); the render then uses the recursive engine and no checkpoint
+    AovBuffers* aovs = nullptr;  // requested passes, filled alongside the image; the render then uses the recursive engine and no checkpoint
+};
+
+/* Counters collected while rendering, shared by all workers */
+struct RenderStats {
+    std::atomic<long long> secondaryRays{0};
+    std::atomic<long long> sortNanos{0};            // time spent ordering secondary rays
+    std::atomic<long long> secondaryTraceNanos{0};  // time spent intersecting secondary rays
+    std::atomic<long long> samples{0};              // camera rays, including anti-aliasing samples
+    std::atomic<long long> probeNanos{0};           // time spent probing tile costs
+    std::atomic<int> scheduledTiles{0};             // tiles after cost-guided splitting, 0 = not scheduled
+    std::atomic<long long> tracedPixels{0};         // pixels given a camera ray, regions and their margin only
+};
+
+// Called from a render worker after every finished tile; done counts the tiles of all passes
+using TileProgress = std::function<void(const Tile& tile, int done, int total)>;
+
+// Renders a width x height RGBA image (delete[] it). Returns nullptr if cancel is set before
+// the render finishes; the tiles finished so far are kept in the checkpoint, if there is one.
+unsigned char* rendering(Reader* scene, const RenderSettings& settings, RenderStats* stats = nullptr,
+                         const std::atomic<bool>* cancel = nullptr, const TileProgress& progress = nullptr);
+
+/////////////////////////
+// Regions of Interest //
+/////////////////////////
+
+// Bounding box of the regions, the whole frame if there are none
+Tile region_Bounds(const std::vector<Tile>& regions);
+bool in_Regions(const std::vector<Tile>& regions, int x, int y);
+
+// The rect's pixels of a width x height RGBA image, row-major
+std::vector<unsigned char> crop_Image(const unsigned char* image, const Tile& rect);
+
+// Copies the regions' pixels of image into base, both width x height RGBA
+void merge_Regions(const unsigned char* image, const std::vector<Tile>& regions, unsigned char* base);
+
+//////////////////////
+// Output Variables //
+//////////////////////
+
+/* Per-pixel passes written by the same traversal as the image, for compositing. Only the
+   passes whose buffer is sized to width x height (see request_Aovs()) are filled; the others
+   cost nothing. */
+struct AovBuffers {
+    std::vector<float> depth;     // distance of the primary hit from the eye, 0 for background
+    std::vector<vec3> normal;     // unit normal at the primary hit, 0 for background
+    std::vector<int> objectId;    // index of the primary hit in the scene's objects, -1 for background
+    std::vector<vec3> direct;     // ambient, diffuse and specular light of a primary OBJ hit, unclamped
+    std::vector<vec3> reflected;  // colour a primary mirror or glass hit passes on
+};
+
+// Sizes the passes named in the comma-separated list ("depth", "normal", "id", "direct",
+// "reflected"); false if a name is unknown. Depth, normal and id are the pixel centre's;
+// direct and reflected are averaged over the anti-aliasing samples like the image, which
+// is their sum where nothing is clamped (before denoising).
+bool request_Aovs(AovBuffers& aovs, const std::string& list);
+
+size_t aov_Bytes(const AovBuffers& aovs);
+
+////////////////
+// Relighting //
+////////////////
+
+/* Everything about a light but its intensity, which is all its shadows depend on */
+struct LightPlacement {
+    int type = DIRECTIONAL;
+    vec3 direction = vec3(0);
+    vec3 position = vec3(0);  // spotlights only
+    float angle = 0;          // spotlights only
+};
+
+/* Light-independent part of every pixel, kept so lights can change without re-tracing */
+struct GBuffer {
+    // Mirrors and glass pass on the colour found further along their path, so a pixel's colour
+    // is either the shading of one OBJ hit (object >= 0) or a colour no light changes
+    struct Texel {
+        vec3 position = vec3(0);  // hit point of the shaded surface
+        vec3 normal = vec3(0);
+        vec3 view = vec3(0);      // unit vector from the hit back along the ray
+        vec3 albedo = vec3(0);    // surface colour at the hit; the fixed colour if object < 0
+        int object = -1;          // index in the scene's objects
+        float alpha = 0;          // alpha of a fixed colour
+    };
+
+    // What a light contributes to a hit before its intensity scales it
+    struct LightTerms {
+        float diffuse = 0;
+        float specular = 0;
+        float visibility = 0;     // 1 if no object shadows the hit, 0 otherwise
+    };
+
+    std::vector<Texel> texels;    // width x height, row-major
+    std::vector<LightTerms> lightTerms;  // per pixel, one per light of the captured scene
+    std::vector<int> objectIds;   // primary hit per pixel, for the anti-aliasing edges
+    GuideBuffers guides;          // denoiser guides, empty if the render was not denoised
+    uint64_t geometry = 0;        // geometry_Fingerprint() of the scene it was captured from
+    std::vector<LightPlacement> lights;  // of the captured scene
+    bool shadows = true;          // whether the capture traced shadow rays
+};
+
+size_t gbuffer_Bytes(const GBuffer& gbuffer);
+
+// Re-shades a G-buffer captured by rendering() with settings.gbuffer set, under the lights and
+// ambient of scene; only lights that moved are shaded again and trace shadow rays. Settings
+// must match the capture. The image is identical to rendering scene in full. Returns nullptr
+// if scene's eye or objects differ from the captured ones.
+unsigned char* relight(Reader* scene, const RenderSettings& settings, const GBuffer& gbuffer, RenderStats* stats = nullptr);
+
+//////////////////////////////
+// Object-Edit Invalidation //
+//////////////////////////////
+
+/* Axis-aligned box, empty while lo > hi */
+struct Bounds3 {
+    vec3 lo = vec3(INFINITY);
+    vec3 hi = vec3(-INFINITY);
+};
+
+/* Where a group of rays went */
+struct RayBounds {
+    Bounds3 start, end;           // segments from a point in start to a hit in end
+    Bounds3 origins, directions;  // half-lines from a point in origins, in a direction in directions, that hit nothing
+};
+
+/* What the rays of one cell's pixels met, anti-aliasing samples included */
+struct TouchedCell {
+    std::vector<uint64_t> objects;  // bit i: a ray hit object i, or object i shadowed a hit
+    std::vector<RayBounds> rays;    // primary rays, reflection/refraction rays, then the shadow rays of each light
+};
+
+/* Per-cell record of the objects and space the rays of a render touched */
+struct TouchMap {
+    static const int CELL = 16;     // cell size in pixels
+    int columns = 0, rows = 0;
+    std::vector<TouchedCell> cells; // row-major
+    uint64_t scene = 0;             // scene_Fingerprint() of the scene last rendered in full
+    std::mutex lock;                // render workers merge their cells under it
+};
+
+size_t touch_Bytes(const TouchMap& touches);
+
+// Cells whose pixels can change when before is edited into after: a ray of the cell met an
+// object that changed, or the new shape of a moved or added object reaches its rays.
+// Every cell if the eye, the ambient or the lights changed.
+std::vector<Tile> edited_Cells(Reader* before, Reader* after, const TouchMap& touches);
+
+// Updates previous, a render of before with settings.touches = &touches, to a render of after
+// by re-rendering only the edited cells and the pixels anti-aliasing and denoising tie to them;
+// the other cells keep their records. The image is identical to rendering after in full.
+// Returns nullptr if touches was not recorded from before. changed, if given, receives the
+// re-rendered regions.
+unsigned char* render_Edits(Reader* before, Reader* after, const RenderSettings& settings, TouchMap& touches,
+                            const unsigned char* previous, RenderStats* stats = nullptr, std::vector<Tile>* changed = nullptr);
+
+////////////////////////
+// Shared Worker Pool //
+////////////////////////
+
+/* Times a pool job's tasks, shared by its batches; nanoseconds are counted from submission */
+struct JobClock {
+    std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+    std::atomic<long long> startNanos{-1};   // first task started, -1 before
+    std::atomic<long long> finishNanos{-1};  // render returned, -1 before
+    std::atomic<long long> workerNanos{0};   // worker time spent in its tasks
+    std::atomic<int> tasks{0};               // tasks finished, of every pass
+
+    long long Now() const;
+};
+
+/* Scheduling counters of a render job, see RenderJob::GetStats() */
+struct RenderJobStats {
+    double queueMs = 0;         // from submission until its first tile started
+    double elapsedMs = 0;       // from submission until it finished, or until now
+    double workerMs = 0;        // worker time spent on its tiles
+    int tiles = 0;              // tiles finished, of every pass (including the cost probe)
+    double tilesPerSecond = 0;  // tiles over the time since the first one started
+};
+
+// Handle of a render submitted to a RenderPool
+class RenderJob
+{
+    private:
+        std::shared_future<std::vector<unsigned char>> m_Image;
+        std::shared_ptr<std::atomic<bool>> m_Cancel;
+        std::shared_ptr<std::atomic<int>> m_TilesDone;
+        std::shared_ptr<std::atomic<int>> m_TileCount;
+        std::shared_ptr<JobClock> m_Clock;
+    public:
+        RenderJob(std::shared_future<std::vector<unsigned char>> image, std::shared_ptr<std::atomic<bool>> cancel,
+                  std::shared_ptr<std::atomic<int>> tilesDone, std::shared_ptr<std::atomic<int>> tileCount,
+                  std::shared_ptr<JobClock> clock)
+            : m_Image(image), m_Cancel(cancel), m_TilesDone(tilesDone), m_TileCount(tileCount), m_Clock(clock) {};
+
+        // width x height RGBA once the render is done, empty if it was cancelled
+        inline const std::shared_future<std::vector<unsigned char>>& GetImage() const { return m_Image; }
+
+        // Stops the render after the tiles in flight; GetImage() then yields an empty image
+        inline void Cancel() { *m_Cancel = true; }
+        inline bool IsCancelled() const { return *m_Cancel; }
+
+        // finished fraction of the tiles of all passes, 0 until the tiles are known
+        float GetProgress() const;
+
+        // queue wait and throughput so far
+        RenderJobStats GetStats() const;
+};
+
+// Fixed set of render workers shared by every render submitted to it. Whenever a worker
+// finishes a tile it takes the next one from the most urgent priority class with work left,
+// so a preview submitted during a final render gets the workers as their tiles finish.
+// Within a class, the render that has had the least worker time since it was queued goes
+// next, so renders of equal priority share the workers evenly however costly their tiles.
+class RenderPool
+{
+    private:
+        struct Batch
+        {
+            int count;
+            std::function<void(int)> task;
+            const std::atomic<bool>* cancel;
+            RenderPriority priority;
+            JobClock* clock;    // of the job the batch belongs to, nullptr for a plain Run()
+            long long serviceNanos = 0;  // worker time received, plus the class minimum when it was queued
+            int next = 0;       // next task to hand out
+            int running = 0;    // tasks handed out and not finished yet
+            int finished = 0;
+            bool done = false;
+        };
+
+        std::vector<std::thread> m_Workers;
+        std::mutex m_Lock;
+        std::condition_variable m_Wake;      // workers: a batch was added, cancelled or the pool stops
+        std::condition_variable m_Finished;  // Run(): a batch finished
+        std::deque<std::shared_ptr<Batch>> m_Batches;
+        bool m_Stopping = false;
+
+        void WorkerLoop();
+        // the batch the next task comes from, nullptr if none has tasks left; m_Lock must be held
+        std::shared_ptr<Batch> PickLocked();
+        // removes a batch whose tasks are all done and wakes Run(); m_Lock must be held
+        void FinishLocked(const std::shared_ptr<Batch>& batch);
+    public:
+        // workers = 0 starts one worker per hardware thread
+        RenderPool(int workers = 0);
+        // Stops the workers; every job submitted to the pool must have finished first
+        ~RenderPool();
+
+        // Runs task(0) ... task(count - 1) on the workers and returns once they are all done,
+        // or once cancel is set and the tasks in flight are done. clock, if given, is charged
+        // with the tasks' time.
+        void Run(int count, const std::function<void(int)>& task, const std::atomic<bool>* cancel = nullptr,
+                 RenderPriority priority = NORMAL_PRIORITY, JobClock* clock = nullptr);
+
+        // Starts rendering scene in the background, with settings.priority; scene must outlive
+        // the job. progress, if given, is called from the workers after every tile.
+        RenderJob Submit(Reader* scene, const RenderSettings& settings, const TileProgress& progress = nullptr);
+
+        inline int GetWorkerCount() const { return (int)m_Workers.size(); }
+};
+
+/////////////////////////
+// Progressive Preview //
+/////////////////////////
+
+/* Latest preview image, handed from the progressive renderer to the viewer */
+struct PreviewFrame {
+    std::mutex lock;
+    std::vector<unsigned char> pixels;  // width x height RGBA
+    int version = 0;                    // bumped after every finished pass
+    std::string pass;                   // description of the latest pass
+    std::atomic<bool> cancel{false};
+};
+
+// Traces every 4th pixel in x and y (1/16 of the frame), then every 2nd, then the rest,
+// and finally supersamples the edges, publishing a preview to frame after every pass
+void render_Progressive(Reader* scene, const RenderSettings& settings, PreviewFrame* frame);
+
+/////////////////////////////
+// Interactive Fly-Through //
+/////////////////////////////
+
+/* Eye moves from the viewer and the frames render_Interactive() traces for them */
+struct FlyThrough {
+    PreviewFrame frame;            // latest frame; frame.cancel drops a full-resolution frame in flight
+    std::mutex lock;
+    std::condition_variable wake;  // the eye moved or the fly-through stops
+    vec3 eye = vec3(0);            // guarded by lock
+    int moves = 0;                 // bumped on every eye change, guarded by lock
+    bool stopping = false;         // guarded by lock
+    double targetMs = 33.0;        // frame time the resolution is adapted to while the eye moves
+    bool temporal = false;         // reproject and accumulate the earlier frames instead of strided previews
+};
+
+// Moves the eye (kept in front of the image plane, z > 0) and drops a full-resolution frame in flight
+void fly_To(FlyThrough* fly, vec3 eye);
+// Ends render_Interactive() after the frame in flight
+void stop_Flying(FlyThrough* fly);
+
+// Renders the scene from fly->eye until stop_Flying(). While the eye moves, frames trace every
+// stride-th pixel in x and y, the stride picked from the measured cost per pixel so that a frame
+// takes about fly->targetMs. Once it stops, the frame is rendered in full with the settings'
+// anti-aliasing and denoising. With fly->temporal, every frame reprojects the previous one to
+// the new eye instead and traces only part of the pixels, in a pattern that rotates from frame
+// to frame, blending each new sample into the pixel's history, until every pixel has averaged
+// a full set of jittered samples. The scene's eye is moved along.
+void render_Interactive(Reader* scene, const RenderSettings& settings, FlyThrough* fly);
+
+/////////////////////////////
+// Time-Budgeted Rendering //
+/////////////////////////////
+
+/* One rung of the time-budget quality ladder, cheapest first */
+struct QualityLevel {
+    int stride;      // trace every stride-th pixel in x and y and upscale the rest
+    int maxDepth;
+    bool shadows;
+    int aaSamples;
+    const char* name;
+};
+
+extern const QualityLevel QUALITY_LEVELS[];
+extern const int QUALITY_LEVEL_COUNT;
+
+/* Best image a time-budgeted render finished before its deadline */
+struct BudgetResult {
+    std::vector<unsigned char> image;  // width x height RGBA, black if no level finished
+    int level = -1;                    // index into QUALITY_LEVELS, -1 if no level finished
+    double elapsedMs = 0;
+};
+
+BudgetResult render_Budgeted(Reader* scene, const RenderSettings& settings, double budgetMs);
+
+/////////////////////////
+// Animation Sequences //
+/////////////////////////
+
+enum VideoFormat {
+    Y4M_VIDEO,      // YUV4MPEG2, 4:2:0 full-range BT.601, for encoders that read it from a pipe
+    RAW_RGB_VIDEO   // width x height x 3 bytes per frame, no header
+};
+
+/* Transforms of a scene before its keyframes are applied, which every frame starts from */
+struct ScenePose {
+    vec3 eye;
+    std::vector<vec3> lightDirections;
+    std::vector<vec3> lightPositions;  // spotlights only
+    std::vector<vec4> objects;         // Surface::getCoordinates()
+};
+
+ScenePose scene_Pose(Reader* scene);
+
+// One past the last keyframed frame, 1 for a scene without keyframes
+int sequence_Length(Reader* scene);
+
+// Moves the eye, lights and objects of scene from rest to frame. Every keyframed track is
+// interpolated linearly between its keyframes and held before the first and after the last.
+void pose_Frame(Reader* scene, const ScenePose& rest, int frame);
+
+// Renders frames [0, frames) of the scene's keyframes and streams them to out; frame n + 1
+// renders while frame n is written. Per-frame times are logged. The scene is left at the
+// last frame's pose. Returns false if writing fails.
+bool render_Sequence(Reader* scene, const RenderSettings& settings, int frames, int fps, VideoFormat format,
+                     FILE* out, std::ostream& log);
+
+///////////////////////////////
+// Checks and Tuning Helpers //
+///////////////////////////////
+
+// hash of the eye, objects and lights
+uint64_t scene_Fingerprint(Reader* scene);
+// hash of the eye and objects, which lights and ambient do not change
+uint64_t geometry_Fingerprint(Reader* scene);
+uint64_t image_Hash(const unsigned char* image);
+std::string hash_String(uint64_t hash);
+
+// res/Scenes/scene1.txt, scene2.txt, ... up to the first one that is missing
+std::vector<std::string> bundled_Scenes();
+
+// Renders each scene at several worker counts and compares the image hashes.
+// Returns the number of scenes whose images differ.
+int determinism_Check(const std::vector<std::string>& sceneFiles, const RenderSettings& settings);
+
+// Parses a copy of the scene on every NUMA node, for RenderSettings::nodeScenes
+std::vector<Reader*> replicate_Scene(const std::string& sceneFile, const RenderSettings& settings);
+
+// Prints the throughput of rendering on 1, 2, ... NUMA nodes
+void numa_Benchmark(Reader* scene, const std::string& sceneFile, const RenderSettings& settings, bool replicate);
+
+// Picks the fastest engine, packet size, tile size and worker count from calibration renders
+RenderSettings autotune(Reader* scene, const RenderSettings& settings);
+TunedSettings tuned_Settings(const RenderSettings& settings);
+std::string describe_Tuning(const RenderSettings& settings);
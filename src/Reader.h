@@ -32,6 +32,7 @@ protected:
     vec4 coordinates = vec4(0, 0, 0, 0);
     vec3 color = vec3(0, 0, 0);
     float shine = 0;
+    int id = -1;  // index in the scene's object list, -1 for objects outside the scene
 
 public:
     virtual vec3 getColor(vec3 hit) = 0;
@@ -57,6 +58,17 @@ public:
     ObjectType getType(){
         return this->type;
     }
+    int getId(){
+        return this->id;
+    }
+    // (centre, radius) of a sphere or (normal, d) of a plane; a sphere keeps its radius
+    void setCoordinates(vec4 coordinates){
+        this->coordinates = coordinates;
+        this->position_cord = vec3(coordinates.x, coordinates.y, coordinates.z);
+    }
+    void setId(int id){
+        this->id = id;
+    }
     
 };
 
@@ -133,6 +145,13 @@ struct Plane : Surface{
     }
 };
 
+/* Shared placeholder object for rays that did not hit anything */
+inline Surface *nothingSurface()
+{
+    static Plane nothing(0.0, 0.0, 0.0, 0.0, NOTHING);
+    return &nothing;
+}
+
 struct Ray
 {
 
@@ -148,8 +167,7 @@ public:
         this->direction = direction;
         this->origin = origin;
         this->hit = origin + direction;
-        this->sceneObject = new Plane(0.0, 0.0, 0.0, 0.0, NOTHING);
-        ;
+        this->sceneObject = nothingSurface();
     }
 
     vec3 getRayDirection()
@@ -269,4 +287,39 @@ struct SpotLight : Light
     }
 };
 
+/* Pose of the eye, a light or an object at one frame of an animation sequence:
+   "v <frame> <x> <y> <z>" places the eye, "l <frame> <light> <tx> <ty> <tz> <yaw>" and
+   "m <frame> <object> <tx> <ty> <tz> <yaw>" turn a light or an object by yaw degrees
+   around the vertical axis through the origin, then move it by t */
+struct Keyframe
+{
+    char track;  // 'v', 'l' or 'm'
+    int index;   // of the light or object in the scene's lists, 0 for the eye
+    int frame;
+    vec3 translation;
+    float yaw;
+};
+
+/* Scene description parsed from a scene file */
+class Reader
+{
+
+public:
+    Eye *eye;
+    vec4 *ambientLight;
+    std::vector<Plane *> *planes;
+    std::vector<Surface *> *objects;
+    std::vector<Light *> *lights;
+    std::vector<SpotLight *> *spotlights;
+    std::vector<Sphere *> *spheres;
+    std::vector<Keyframe> *keyframes;
+
+    Reader();
+
+    void parser(std::string fileName);
+
+    static ObjectType getType(char c);
+
+};
+
 #endif
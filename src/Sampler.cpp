@@ -0,0 +1,221 @@
+#include <Sampler.h>
+
+#include <vector>
+
+namespace
+{
+    const int s_BlueNoiseSize = 32;
+    const int s_Primes[16] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+
+    // Primitive polynomials and initial direction numbers (Joe & Kuo) for dimensions 2..8,
+    // dimension 1 is the van der Corput sequence
+    struct SobolPolynomial
+    {
+        int degree;
+        uint32_t coefficients;
+        uint32_t initial[5];
+    };
+    const SobolPolynomial s_SobolPolynomials[7] = {
+        { 1, 0, { 1 } },
+        { 2, 1, { 1, 3 } },
+        { 3, 1, { 1, 3, 1 } },
+        { 3, 2, { 1, 1, 1 } },
+        { 4, 1, { 1, 1, 3, 3 } },
+        { 4, 4, { 1, 3, 5, 13 } },
+        { 5, 2, { 1, 1, 5, 5, 17 } }
+    };
+
+    // Maps 24 random bits to [0, 1)
+    inline float ToUnit(uint32_t bits)
+    {
+        return (bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+    inline float Wrap(float value)
+    {
+        value -= glm::floor(value);
+        return glm::min(value, 0.99999994f);
+    }
+
+    // Blue noise tile: cells ranked by a best-candidate ordering on the torus, so every
+    // prefix of the ranks is spread out evenly. Built once, read-only afterwards.
+    const std::vector<float>& BlueNoiseTile()
+    {
+        static const std::vector<float> tile = []() {
+            int size = s_BlueNoiseSize;
+            int cells = size * size;
+            std::vector<float> ranks(cells, -1.0f);
+            std::vector<int> minDistance(cells, INT32_MAX);
+
+            int chosen = 0;
+            for (int rank = 0; rank < cells; rank++)
+            {
+                ranks[chosen] = (rank + 0.5f) / cells;
+                int cx = chosen % size, cy = chosen / size;
+
+                int next = -1;
+                for (int c = 0; c < cells; c++)
+                {
+                    if (ranks[c] >= 0.0f)
+                        continue;
+                    int dx = glm::abs(c % size - cx), dy = glm::abs(c / size - cy);
+                    dx = glm::min(dx, size - dx);
+                    dy = glm::min(dy, size - dy);
+                    minDistance[c] = glm::min(minDistance[c], dx * dx + dy * dy);
+
+                    // farthest from everything placed so far, ties broken by hash
+                    if (next < 0 || minDistance[c] > minDistance[next] ||
+                        (minDistance[c] == minDistance[next] && Sampler::Hash(c) > Sampler::Hash(next)))
+                        next = c;
+                }
+                chosen = next;
+            }
+            return ranks;
+        }();
+        return tile;
+    }
+}
+
+Sampler::Sampler(SampleSequence sequence, int samplesPerPixel)
+    : m_Sequence(sequence), m_SamplesPerPixel(glm::max(1, samplesPerPixel))
+{
+    m_Strata = (int)glm::ceil(glm::sqrt((float)m_SamplesPerPixel));
+
+    for (int bit = 0; bit < 32; bit++)
+        m_SobolDirections[0][bit] = 1u << (31 - bit);
+
+    for (int d = 1; d < s_SobolDimensions; d++)
+    {
+        const SobolPolynomial& polynomial = s_SobolPolynomials[d - 1];
+        int degree = polynomial.degree;
+        uint32_t* v = m_SobolDirections[d];
+
+        for (int bit = 0; bit < degree; bit++)
+            v[bit] = polynomial.initial[bit] << (31 - bit);
+
+        for (int bit = degree; bit < 32; bit++)
+        {
+            v[bit] = v[bit - degree] ^ (v[bit - degree] >> degree);
+            for (int k = 1; k < degree; k++)
+            {
+                if ((polynomial.coefficients >> (degree - 1 - k)) & 1)
+                    v[bit] ^= v[bit - k];
+            }
+        }
+    }
+
+    if (m_Sequence == BLUE_NOISE)
+        BlueNoiseTile();
+}
+
+uint32_t Sampler::Hash(uint32_t value)
+{
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return value;
+}
+
+uint32_t Sampler::Hash(int x, int y, int sampleIndex, int dimension)
+{
+    uint32_t h = Hash((uint32_t)x + 0x9e3779b9u);
+    h = Hash(h ^ ((uint32_t)y + 0x7f4a7c15u));
+    h = Hash(h ^ ((uint32_t)sampleIndex + 0x94d049bbu));
+    return Hash(h ^ ((uint32_t)dimension + 0xbf58476du));
+}
+
+float Sampler::Stratified(int x, int y, int sampleIndex, int dimension) const
+{
+    // each pixel and dimension walks the strata from its own starting point
+    uint32_t start = Hash(x, y, -1, dimension) % m_SamplesPerPixel;
+    int stratum = (sampleIndex + start) % m_SamplesPerPixel;
+    return (stratum + ToUnit(Hash(x, y, sampleIndex, dimension))) / m_SamplesPerPixel;
+}
+
+float Sampler::Halton(int x, int y, int sampleIndex, int dimension) const
+{
+    int base = s_Primes[dimension % 16];
+    float inverseBase = 1.0f / base;
+    float fraction = inverseBase;
+    float value = 0.0f;
+
+    for (uint32_t index = sampleIndex; index > 0; index /= base)
+    {
+        value += (index % base) * fraction;
+        fraction *= inverseBase;
+    }
+
+    // Cranley-Patterson rotation decorrelates neighbouring pixels
+    return Wrap(value + ToUnit(Hash(x, y, -1, dimension)));
+}
+
+float Sampler::Sobol(int x, int y, int sampleIndex, int dimension) const
+{
+    const uint32_t* v = m_SobolDirections[dimension % s_SobolDimensions];
+    uint32_t bits = 0;
+
+    for (uint32_t index = sampleIndex, bit = 0; index > 0; index >>= 1, bit++)
+    {
+        if (index & 1)
+            bits ^= v[bit];
+    }
+
+    // random digit scrambling keeps the stratification of every power-of-two prefix
+    return ToUnit(bits ^ Hash(x, y, -1, dimension));
+}
+
+float Sampler::BlueNoise(int x, int y, int sampleIndex, int dimension) const
+{
+    const std::vector<float>& tile = BlueNoiseTile();
+    uint32_t offset = Hash(0, 0, -1, dimension);
+    int tx = (x + (offset & 0xffff)) % s_BlueNoiseSize;
+    int ty = (y + (offset >> 16)) % s_BlueNoiseSize;
+
+    // golden ratio steps keep successive samples of one pixel apart
+    return Wrap(tile[tx + ty * s_BlueNoiseSize] + sampleIndex * 0.618033989f);
+}
+
+float Sampler::Get1D(int x, int y, int sampleIndex, int dimension) const
+{
+    switch (m_Sequence)
+    {
+        case STRATIFIED:
+            return Stratified(x, y, sampleIndex, dimension);
+        case HALTON:
+            return Halton(x, y, sampleIndex, dimension);
+        case SOBOL:
+            return Sobol(x, y, sampleIndex, dimension);
+        default:
+            return BlueNoise(x, y, sampleIndex, dimension);
+    }
+}
+
+glm::vec2 Sampler::Get2D(int x, int y, int sampleIndex, int dimension) const
+{
+    if (m_Sequence != STRATIFIED)
+        return glm::vec2(Get1D(x, y, sampleIndex, dimension), Get1D(x, y, sampleIndex, dimension + 1));
+
+    // jittered grid of m_Strata x m_Strata cells
+    int cells = m_Strata * m_Strata;
+    uint32_t start = Hash(x, y, -1, dimension) % cells;
+    int cell = (sampleIndex + start) % cells;
+    glm::vec2 jitter(ToUnit(Hash(x, y, sampleIndex, dimension)), ToUnit(Hash(x, y, sampleIndex, dimension + 1)));
+    return (glm::vec2(cell % m_Strata, cell / m_Strata) + jitter) / (float)m_Strata;
+}
+
+bool Sampler::ParseSequence(const std::string& name, SampleSequence& sequence)
+{
+    if (name == "stratified")
+        sequence = STRATIFIED;
+    else if (name == "halton")
+        sequence = HALTON;
+    else if (name == "sobol")
+        sequence = SOBOL;
+    else if (name == "bluenoise")
+        sequence = BLUE_NOISE;
+    else
+        return false;
+    return true;
+}
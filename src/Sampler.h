@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+
+enum SampleSequence
+{
+    STRATIFIED,
+    HALTON,
+    SOBOL,
+    BLUE_NOISE
+};
+
+// Deterministic sample points in [0, 1) indexed by pixel, sample index and dimension.
+// A Sampler holds only read-only tables, so any number of workers can share one.
+class Sampler
+{
+    private:
+        static const int s_SobolDimensions = 8;
+
+        SampleSequence m_Sequence;
+        int m_SamplesPerPixel;
+        int m_Strata;
+        uint32_t m_SobolDirections[s_SobolDimensions][32];
+
+        float Stratified(int x, int y, int sampleIndex, int dimension) const;
+        float Halton(int x, int y, int sampleIndex, int dimension) const;
+        float Sobol(int x, int y, int sampleIndex, int dimension) const;
+        float BlueNoise(int x, int y, int sampleIndex, int dimension) const;
+    public:
+        Sampler(SampleSequence sequence, int samplesPerPixel);
+
+        float Get1D(int x, int y, int sampleIndex, int dimension) const;
+        glm::vec2 Get2D(int x, int y, int sampleIndex, int dimension) const;
+
+        inline SampleSequence GetSequence() const { return m_Sequence; }
+
+        // Stateless integer hash used to decorrelate pixels and dimensions
+        static uint32_t Hash(uint32_t value);
+        static uint32_t Hash(int x, int y, int sampleIndex, int dimension);
+
+        // Parses "stratified", "halton", "sobol" or "bluenoise"; returns false for anything else
+        static bool ParseSequence(const std::string& name, SampleSequence& sequence);
+};
@@ -0,0 +1,78 @@
+#include <TuningCache.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+bool TuningCache::Load(const std::string& key, TunedSettings& settings) const
+{
+    std::ifstream file(m_Filepath);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos || line.compare(0, tab, key) != 0 || tab != key.size())
+            continue;
+
+        TunedSettings loaded;
+        std::istringstream values(line.substr(tab + 1));
+        if (!(values >> loaded.TileSize >> loaded.PacketSize >> loaded.Threads >> loaded.Wavefront >> loaded.SortSecondary))
+            return false;
+        if (loaded.TileSize < 1 || loaded.PacketSize < 0 || loaded.Threads < 0)
+            return false;
+        settings = loaded;
+        return true;
+    }
+    return false;
+}
+
+bool TuningCache::Store(const std::string& key, const TunedSettings& settings) const
+{
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(m_Filepath);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.compare(0, key.size() + 1, key + "\t") != 0)
+                lines.push_back(line);
+        }
+    }
+
+    std::ostringstream entry;
+    entry << key << '\t' << settings.TileSize << ' ' << settings.PacketSize << ' ' << settings.Threads << ' '
+          << settings.Wavefront << ' ' << settings.SortSecondary;
+    lines.push_back(entry.str());
+
+    std::string temporary = m_Filepath + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        for (const std::string& line : lines)
+            file << line << '\n';
+        if (!file)
+            return false;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    std::remove(m_Filepath.c_str());
+#endif
+    return std::rename(temporary.c_str(), m_Filepath.c_str()) == 0;
+}
+
+std::string TuningCache::MachineKey()
+{
+    std::string model = "unknown CPU";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.compare(0, 10, "model name") != 0)
+            continue;
+        size_t colon = line.find(':');
+        if (colon != std::string::npos && colon + 2 <= line.size())
+            model = line.substr(colon + 2);
+        break;
+    }
+    return model + " x" + std::to_string(std::thread::hardware_concurrency());
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+// Render parameters picked by the auto-tuner; none of them changes the pixels
+struct TunedSettings
+{
+    int TileSize = 32;
+    int PacketSize = 8;
+    int Threads = 0;
+    bool Wavefront = false;
+    bool SortSecondary = false;
+};
+
+// Text file of tuned settings, one line per key ("<key>\t<tile> <packet> <threads> <wavefront> <sort>").
+// Keys name the machine and the scene, see MachineKey().
+class TuningCache
+{
+    private:
+        std::string m_Filepath;
+    public:
+        TuningCache(const std::string& filepath)
+            : m_Filepath(filepath) {};
+
+        // false if the file or the key is missing
+        bool Load(const std::string& key, TunedSettings& settings) const;
+
+        // Adds or replaces the key's line; the file is rewritten through a temporary file
+        bool Store(const std::string& key, const TunedSettings& settings) const;
+
+        inline const std::string& GetFilepath() const { return m_Filepath; }
+
+        // CPU model from /proc/cpuinfo and the hardware thread count, e.g. "Intel(R) Xeon(R) x16"
+        static std::string MachineKey();
+};
@@ -11,13 +11,34 @@
 #include <Shader.h>
 #include <Texture.h>
 #include <Camera.h>
+#include <Denoiser.h>
+#include <TuningCache.h>
+#include <PngWriter.h>
+#include <RayTracer.h>
+
+#include <stb/stb_image.h>
 
 #include <iostream>
-#include "Reader.cpp"
-/* Window size */
-const unsigned int width = 800;
-const unsigned int height = 800;
-const float PI = 3.14159265;
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <set>
+#include <functional>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+
 /* Shape vertices coordinates with positions, colors, and corrected texCoords */
 float vertices[] = {
     // positions   // texCoords (flipped Y-axis)
@@ -33,489 +54,7 @@ unsigned int indices[] = { // first and second triangle
     0, 2, 3  
 };
 
-void init_ray(Surface* closestObject, Ray reflectedRay){
-    closestObject = new Plane(0.0, 0.0, 0.0, 0.0, NOTHING);
-    reflectedRay.setHitPoint(reflectedRay.getRayOrigin() + reflectedRay.getRayDirection());
-    reflectedRay.setSceneObject(closestObject);
-}
-
-float calcA(Ray ray){
-    vec3 direction = ray.getRayDirection();
-    float result = dot(direction, direction);
-    return result;
-}
-
-float calcB(vec3 oc, Ray ray){
-    vec3 direction = ray.getRayDirection();
-    float result = dot(oc, direction);
-    return 2.0f * result;
-}
-
-float calcC(vec3 oc, Sphere* sph){
-    float result = dot(oc, oc);
-    float multi = sph->getRadius() * sph->getRadius();
-    return result - multi;
-}
-Ray UpdateRay(int j, int i, Surface* ob, bool update, Ray reflectedRay, Reader* scene) {
-
-    float width = 2.0f / 800.0f;
-    float height = 2.0f / 800.0f;
-
-    if (!update) {
-        vec3 pixelCenter(-1 + width / 2, 1 - height / 2, 0);
-        vec3 exactPixel = pixelCenter + vec3(j * width, -1 * (i * height), 0);
-        vec3 eyeVec = scene->eye->getCoordinates();
-        vec3 rayDirection = normalize(exactPixel - eyeVec);
-
-        reflectedRay.setRayDirection(rayDirection);
-        reflectedRay.setRayOrigin(eyeVec);
-    }
-
-    // update the ray
-    Surface* closestObject = NULL;
-    init_ray(closestObject, reflectedRay);
-    float nearest_obj = INFINITY;
-
-    for (int i = 0; i < scene->objects->size(); i++) {
-        float t = 0.0;
-        Surface* currentObject = scene->objects->at(i);
-        if (currentObject != ob) {
-
-            if (currentObject->getObjectClass() == SPHERE) {       // sphere          
-                vec3 oc = reflectedRay.getRayOrigin() - currentObject->getPosition();
-                float a, b, c;
-                a = calcA(reflectedRay);
-                b = calcB(oc, reflectedRay);
-                c = calcC(oc, (Sphere*)currentObject);
-
-                float quad_delta = b * b - 4 * a * c; // Discriminant of the quadratic equation
-
-                if (quad_delta >= 0) {
-                    float quad_ans1 = (-b - sqrt(quad_delta)) / (2.0f * a);
-                    float quad_ans2 = (-b + sqrt(quad_delta)) / (2.0f * a);
-
-                    if (quad_ans1 < 0 && quad_ans2 < 0) {
-                        t = -1.0f; // no intersection
-
-                    }
-                    float first;
-                    if(quad_ans1 >= 0)
-                        first = quad_ans1;
-                    else
-                        first = quad_ans2;
-
-                    if (first <= 0.0001f) {
-                        float second = (quad_ans1 >= 0 && quad_ans2 >= 0) ? glm::max(quad_ans1, quad_ans2) : -1.0f;
-                        t = second;
-
-                    }
-                    else {
-                        t = first;
-
-                    }
-                }
-                else {
-                    t = -1.0f;
-                }
-            }
-
-            else { // plane
-                float denominator = glm::dot(reflectedRay.getRayDirection(), currentObject->getPosition());
-
-                if (abs(denominator) < 0.0001f) {
-                    t = -1.0f; // No intersection
-
-                }
-                // intersection equation
-                t = -(glm::dot(reflectedRay.getRayOrigin(), currentObject->getPosition()) + ((Plane*)currentObject)->getD()) / denominator;
-
-                if (t < 0.0f) {
-                    t = -1.0f; // No intersection
-                }
-            }
-            if ((t >= 0) && t < nearest_obj) {
-                closestObject = currentObject;
-                nearest_obj = t;
-                reflectedRay.setSceneObject(closestObject);
-                reflectedRay.setHitPoint(reflectedRay.getRayOrigin() + reflectedRay.getRayDirection() * nearest_obj);
-            }
-        }
-    }
-
-    return reflectedRay;
-}
-
-vec3 get_Normal(vec3 hit_point, Surface* obj) {
-    if (obj->getObjectClass() == SPHERE) {
-        return normalize(hit_point - ((Sphere*)obj)->getPosition());
-    }
-    else
-        return normalize(vec3(obj->getCoordinates()));
-}
-
-float calc_defuse(vec3 N, Ray ray, Light* light) { //defuse
-
-    if (ray.getSceneObject()->getObjectClass() == SPHERE) {
-        vec3 light_Direction = normalize(light->direction);
-        if (light->type == SPOTLIGHT) {
-            vec3 SpotRay = normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
-            float cos = dot(SpotRay, light_Direction);
-            if (cos >= ((SpotLight*)light)->getAngle()){
-
-                light_Direction = SpotRay;
-                cos = dot(N, -light_Direction);
-                return glm::max(cos, 0.0f);;
-            }
-            else {
-                return 0.0f;
-            }
-        }
-        else { // DIRECTIONAL
-            float cos = dot(N, -light_Direction);
-            return glm::max(cos, 0.0f);;
-        }
-    }
-    else { // PLANE
-        vec3 light_Direction = -normalize(light->direction);
-        if (light->type == SPOTLIGHT) {
-            vec3 SpotRay = normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
-            float cos = dot(SpotRay, -light_Direction);
-            if (cos >= ((SpotLight*)light)->getAngle()){
-                light_Direction = -SpotRay;
-                cos = dot(N, -light_Direction);
-                return glm::max(cos, 0.0f);;
-            }
-            else {
-                return 0.0f;
-            }
-        }
-        else { // DIRECTIONAL
-            float cos = dot(N, -light_Direction);
-            return glm::max(cos, 0.0f);
-        }
-    }
-}
-
-float calc_specular(vec3 V, Ray ray, Light* light) { //specular
-    if (ray.getSceneObject()->getObjectClass() == SPHERE) { // sphere
-        vec3 light_Direction = normalize(light->direction);
-        vec3 normal_Sphere = get_Normal(ray.getHitPoint(), ray.getSceneObject());
-
-        if (light->type == SPOTLIGHT) { // SPOTLIGHT
-            vec3 Spot_Ray = normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
-            float cos = dot(Spot_Ray, light_Direction);
-            if (cos >= ((SpotLight*)light)->getAngle()) {
-                light_Direction = Spot_Ray;
-                vec3 reflected_Equation = light_Direction - 2.0f * normal_Sphere * dot(light_Direction, normal_Sphere);
-                float cos = dot(V, reflected_Equation);
-                cos = glm::max(0.0f, cos);
-                return pow(cos, ray.getSceneObject()->getShininess());
-            }
-            else {
-                return 0.0f;
-            }
-        }
-        else { // DIRECTIONAL
-            vec3 reflected_Equation = light_Direction - 2.0f * normal_Sphere * dot(light_Direction, normal_Sphere);
-            float cos = dot(V, reflected_Equation);
-            cos = glm::max(0.0f, cos);
-            return pow(cos, ray.getSceneObject()->getShininess());
-        }
-    }
-
-    else { // plane
-        vec3 light_Direction = normalize(light->direction);
-        vec3 normal_Plane = get_Normal(ray.getHitPoint(), ray.getSceneObject());
-        if (light->type == DIRECTIONAL) {
-            vec3 reflected_Equation = light_Direction - 2.0f * normal_Plane * dot(light_Direction, normal_Plane);
-            float cos = dot(V, reflected_Equation);
-            cos = glm::max(0.0f, cos);
-            return pow(cos, ray.getSceneObject()->getShininess());
-        }
-        else {
-            vec3 SpotRay = normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
-            float cos = dot(SpotRay, light_Direction);
-            if (cos < ((SpotLight*)light)->getAngle()) {
-                return 0.0f;
-            }
-            else {
-                light_Direction = SpotRay;
-                vec3 reflected_Equation = light_Direction - 2.0f * normal_Plane * dot(light_Direction, normal_Plane);
-                float cos = dot(V, reflected_Equation);
-                cos = glm::max(0.0f, cos);
-                return pow(cos, ray.getSceneObject()->getShininess());
-            }
-        }
-    }
-}
-
-float calc_shadow(Ray ray, Light* light, Reader* scene) { //shadow
-
-    vec3 light_Direction = glm::normalize(light->direction);
-    float closest_obj = INFINITY;
-
-    if (light->type == SPOTLIGHT) {
-        vec3 SpotRay = glm::normalize(ray.getHitPoint() - ((SpotLight*)light)->getPosition());
-        float cos = dot(SpotRay, light_Direction);
-
-        if (cos >= ((SpotLight*)light)->getAngle()) {
-            light_Direction = SpotRay;
-            vec3 position = ((SpotLight*)light)->getPosition();
-            vec3 hit_point = ray.getHitPoint();
-            closest_obj = glm::length(position - hit_point);
-        }
-        else {
-            return 0.0f;
-        }
-    }
-
-    for (int i = 0; i < scene->objects->size(); i++) {
-        Surface* currentObject = scene->objects->at(i);
-
-        if (currentObject != ray.getSceneObject()) {
-            Ray ray_oppo = Ray(-light_Direction, ray.getHitPoint());
-            float temp = 0.0;
-
-            if (currentObject != ray.getSceneObject()) {
-
-                if (currentObject->getObjectClass() == PLANE) {
-                    float denominator = glm::dot(ray_oppo.getRayDirection(), currentObject->getPosition());
-
-                    if (abs(denominator) < 0.0001f) {
-                        temp = -1.0f; // No intersection
-
-                    }
-                    // intersection equation
-                    temp = -(glm::dot(ray_oppo.getRayOrigin(), currentObject->getPosition()) + ((Plane*)currentObject)->getD()) / denominator;
-
-                    if (temp < 0.0f) {
-                        temp = -1.0f; // No intersection
-
-                    }
-
-                }
-
-                else {
-                    vec3 oc = ray_oppo.getRayOrigin() - currentObject->getPosition();
-                    float a, b, c;
-                    a = calcA(ray_oppo);
-                    b = calcB(oc, ray_oppo);
-                    c = calcC(oc, (Sphere*)currentObject);
-
-                    float quad_delta = b * b - 4 * a * c; // Discriminant of the quadratic equation
-
-                    if (quad_delta < 0) {
-                        temp = -1.0f;
-
-                    }
-                    else {
-                        float quad_ans1 = (-b - sqrt(quad_delta)) / (2.0f * a);
-                        float quad_ans2 = (-b + sqrt(quad_delta)) / (2.0f * a);
-
-                        if (quad_ans1 < 0 && quad_ans2 < 0) {
-                            temp = -1.0f; // no intersection
-
-                        }
-                        float first;
-                        if(quad_ans1 >= 0)
-                            first = quad_ans1;
-                        else
-                            first = quad_ans2;
-
-                        if (first <= 0.0001f) {
-                            float second = (quad_ans1 >= 0 && quad_ans2 >= 0) ? glm::max(quad_ans1, quad_ans2) : -1.0f;
-                            temp = second;
-
-                        }
-                        else {
-                            temp = first;
-
-                        }
-                    }
-                }
-            }
-
-            if ((temp > 0) && (temp < closest_obj)) {
-                return 0.0;
-            }
-
-        }
-    }
-
-    return 1.0;
-}
-
-// calc Snell Law
-Ray calc_Snell_Law(Ray ray, glm::vec3 N, glm::vec3 rayDirection, float snellFrac) {
-    vec3 normal_surface = get_Normal(-ray.getHitPoint(), ray.getSceneObject());
-    float cos_a = dot(normal_surface, -ray.getRayDirection());
-    float theta_a = acos(cos_a) * (180.0f / PI);
-
-    // change in transparent sphere
-    float snell_Fraction = (1.0f / 1.5f);
-
-    float sin_a = sin(theta_a * (PI / 180.0f));
-    float sin_b = snell_Fraction * sin_a;
-    float theta_b = asin(sin_b) * (180.0f / PI);
-    float cos_b = cos(theta_b * (PI / 180.0f));
-
-    vec3 calc_snellMulti1 = (snellFrac * cos_a - cos_b) * N;
-    vec3 calc_snellMulti2 = snellFrac * (-ray.getRayDirection());
-    vec3 direc_ray = calc_snellMulti1 - calc_snellMulti2;
-    Ray new_Ray(direc_ray, ray.getHitPoint());
-    return new_Ray;
-}
-
-vec4 GetPixelColor(int pixelX, int pixelY, Ray currentRay, int recursionDepth, Reader* scene) {
-    vec3 finalColor(0, 0, 0);
-    vec3 emittedLight(0, 0, 0);
-    vec3 specularComponent(0, 0, 0); 
-    vec3 accumulatedLight(0, 0, 0);
-    vec3 ambientReflectance(0, 0, 0);
-    vec3 ambientLight(0, 0, 0);
-    vec3 reflectiveComponent(0, 0, 0);
-    vec3 reflectedLight(0, 0, 0);
-    vec3 diffuseComponent(0, 0, 0); 
-    if (currentRay.getSceneObject()->getType() == OBJ) { // Handle OBJ type
-        ambientReflectance = currentRay.getSceneObject()->getColor(currentRay.getHitPoint());
-        ambientLight = vec3(scene->ambientLight->r, scene->ambientLight->g, scene->ambientLight->b);
-
-        for (int lightIndex = 0; lightIndex < scene->lights->size(); ++lightIndex) {
-            vec3 specularReflectance(0.7f, 0.7f, 0.7f);
-            vec3 diffuseReflectance = currentRay.getSceneObject()->getColor(currentRay.getHitPoint()) * scene->lights->at(lightIndex)->getIntensity();
-            specularReflectance *= scene->lights->at(lightIndex)->getIntensity();
-
-            vec3 normal = get_Normal(currentRay.getHitPoint(), currentRay.getSceneObject());
-            vec3 viewDirection = normalize(currentRay.getRayOrigin() - currentRay.getHitPoint());
-
-            diffuseComponent = diffuseReflectance * calc_defuse(normal, currentRay, scene->lights->at(lightIndex));
-            specularComponent = specularReflectance * calc_specular(viewDirection, currentRay, scene->lights->at(lightIndex));
-
-            float lightVisibility = calc_shadow(currentRay, scene->lights->at(lightIndex), scene);
-
-            accumulatedLight += (diffuseComponent + specularComponent) * lightVisibility;
-        }
-    }
-
-    finalColor = emittedLight + (ambientReflectance * ambientLight) + accumulatedLight + (reflectiveComponent * reflectedLight);
-
-    if (currentRay.getSceneObject()->getType() == REFLECTIVE) { // Handle reflective type
-        if (recursionDepth == 5) {
-            return vec4(0.f, 0.f, 0.f, 0.f);
-        }
-
-        vec3 reflectionDirection = currentRay.getRayDirection() - 2.0f * get_Normal(currentRay.getHitPoint(), currentRay.getSceneObject()) * dot(currentRay.getRayDirection(), get_Normal(currentRay.getHitPoint(), currentRay.getSceneObject()));
-        Ray reflectedRay(reflectionDirection, currentRay.getHitPoint());
-        reflectedRay = UpdateRay(pixelX, pixelY, currentRay.getSceneObject(), true, reflectedRay, scene);
-
-        if (reflectedRay.getSceneObject()->getType() == NOTHING) {
-            return vec4(0.f, 0.f, 0.f, 0.f);
-        }
-
-        vec4 reflectedColor = GetPixelColor(pixelX, pixelY, reflectedRay, recursionDepth + 1, scene);
-        finalColor = vec3(reflectedColor.r, reflectedColor.g, reflectedColor.b);
-    }
-
-    if (currentRay.getSceneObject()->getType() == TRANSPARENT) { // Handle transparent type
-        if (recursionDepth == 5) {
-            return vec4(0.f, 0.f, 0.f, 0.f);
-        }
-
-        vec3 surfaceNormal = get_Normal(currentRay.getHitPoint(), currentRay.getSceneObject());
-        float refractionRatio = (0.5f / 1.5f); // tran ratio
-        Ray refractedRay = calc_Snell_Law(currentRay, surfaceNormal, currentRay.getRayDirection(), refractionRatio);
-
-        Plane* blackPlane = new Plane(0.0, 0.0, 0.0, 0.0, NOTHING);
-        refractedRay = UpdateRay(pixelX, pixelY, blackPlane, true, refractedRay, scene);
-
-        Surface* currentObject = currentRay.getSceneObject();
-        float intersectionDistance = 0.0f;
-
-        if (currentObject->getObjectClass() == PLANE) {
-            float denominator = glm::dot(currentRay.getRayDirection(), currentObject->getPosition());
-
-            if (abs(denominator) < 0.0001f) {
-                intersectionDistance = -1.0f;
-            }
-
-            intersectionDistance = -(glm::dot(currentRay.getRayOrigin(), currentObject->getPosition()) + ((Plane*)currentObject)->getD()) / denominator;
-
-            if (intersectionDistance < 0.0f) {
-                intersectionDistance = -1.0f;
-            }
-        } else {
-            vec3 rayOriginOffset = currentRay.getRayOrigin() - currentObject->getPosition();
-            float a = calcA(currentRay);
-            float b = calcB(rayOriginOffset, currentRay);
-            float c = calcC(rayOriginOffset, (Sphere*)currentObject);
-
-            float discriminant = b * b - 4 * a * c;
-
-            if (discriminant < 0) {
-                intersectionDistance = -1.0f;
-            } else {
-                float quad_ans1 = (-b - sqrt(discriminant)) / (2.0f * a);
-                float quad_ans2 = (-b + sqrt(discriminant)) / (2.0f * a);
-
-                if (quad_ans1 < 0 && quad_ans2 < 0) {
-                    intersectionDistance = -1.0f;
-                }
-
-                float closest_Hit;
-                if(quad_ans1 >= 0)
-                    closest_Hit = quad_ans1;
-                else
-                    closest_Hit = quad_ans2;
-
-                if (closest_Hit <= 0.0001f) {
-                    float furtherHit = (quad_ans1 >= 0 && quad_ans2 >= 0) ? glm::max(quad_ans1, quad_ans2) : -1.0f;
-                    intersectionDistance = furtherHit;
-                } else {
-                    intersectionDistance = closest_Hit;
-                }
-            }
-        }
-
-        vec3 secondaryHitPoint = refractedRay.getRayOrigin() + refractedRay.getRayDirection() * intersectionDistance;
-        surfaceNormal = get_Normal(secondaryHitPoint, refractedRay.getSceneObject());
-        Ray transmittedRay = calc_Snell_Law(refractedRay, surfaceNormal, refractedRay.getRayDirection(), refractionRatio);
-
-        transmittedRay = UpdateRay(pixelX, pixelY, refractedRay.getSceneObject(), true, refractedRay, scene);
-
-        if (transmittedRay.getSceneObject()->getType() == NOTHING) {
-            return vec4(0.f, 0.f, 0.f, 0.f);
-        }
-
-        vec4 transmittedColor = GetPixelColor(pixelX, pixelY, transmittedRay, recursionDepth + 1, scene);
-        finalColor = vec3(transmittedColor.r, transmittedColor.g, transmittedColor.b);
-    }
-
-    finalColor = min(finalColor, vec3(1.0, 1.0, 1.0));
-    finalColor = max(finalColor, vec3(0.0, 0.0, 0.0));
-    return vec4(finalColor.r, finalColor.g, finalColor.b, 1.0);
-}
-
-
-unsigned char* rendering(Reader* scene) {
-    auto* image = new unsigned char[width * height * 4];
-
-    for (int i = 0; i < width; i++) {
-        for (int j = 0; j < height; j++) {
-            Plane* black_Plane = new Plane(0.0, 0.0, 0.0, 0.0, NOTHING);
-            Ray init_ray(vec3(0, 0, 0), vec3(0, 0, 0));
-            Ray ray = UpdateRay(j, i, black_Plane, false, init_ray, scene);
-            vec4 color = GetPixelColor(j, i, ray, 0, scene);
-
-            image[(j + width * i) * 4] = (unsigned char)(color.r * 255);
-            image[(j + width * i) * 4 + 1] = (unsigned char)(color.g * 255);
-            image[(j + width * i) * 4 + 2] = (unsigned char)(color.b * 255);
-            image[(j + width * i) * 4 + 3] = (unsigned char)(color.a * 255);
-        }
-    }
-    return image;
-}
-
-
+const char* const TUNING_CACHE_FILE = "autotune.cache";
 
 // helper function
 void setup_openGL(GLuint VBO, GLuint VAO, GLuint EBO){
@@ -532,7 +71,9 @@ void setup_openGL(GLuint VBO, GLuint VAO, GLuint EBO){
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 }
 
-void display_Image(unsigned char* data) {
+// Shows data, or the passes of a progressive render as they are published to preview. With fly,
+// the camera inputs move fly's eye and its frames are shown instead.
+void display_Image(unsigned char* data, PreviewFrame* preview = nullptr, FlyThrough* fly = nullptr) {
     GLFWwindow* window;
 
     /*init */
@@ -628,10 +169,44 @@ void display_Image(unsigned char* data) {
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
 
+    // the camera starts at the eye and moves it
+    Camera camera(width, height);
+    glm::vec3 sentEye;
+    if (fly) {
+        preview = &fly->frame;
+        {
+            std::lock_guard<std::mutex> guard(fly->lock);
+            sentEye = fly->eye;
+        }
+        camera.SetPosition(sentEye);
+        camera.EnableInputs(window);
+    }
+
     // rendering loop
+    int shownVersion = 0;
     while (!glfwWindowShouldClose(window)) {
         glClear(GL_COLOR_BUFFER_BIT);
 
+        if (fly && camera.GetPosition() != sentEye) {
+            sentEye = camera.GetPosition();
+            fly_To(fly, sentEye);
+        }
+
+        if (preview) {
+            std::lock_guard<std::mutex> guard(preview->lock);
+            if (preview->version != shownVersion) {
+                shownVersion = preview->version;
+                glBindTexture(GL_TEXTURE_2D, texture);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, preview->pixels.data());
+                glGenerateMipmap(GL_TEXTURE_2D);
+                // frames come too fast for the console while flying
+                if (fly)
+                    glfwSetWindowTitle(window, ("Ray Traced Image - " + preview->pass).c_str());
+                else
+                    std::cout << "Preview: " << preview->pass << std::endl;
+            }
+        }
+
         glUseProgram(shaderProgram);
         glBindTexture(GL_TEXTURE_2D, texture);
         glBindVertexArray(VAO);
@@ -650,13 +225,508 @@ void display_Image(unsigned char* data) {
     glfwTerminate();
 }
 
+// Writes a width x height image of channels (1 or 3) floats per pixel as a PFM file, whose
+// rows run bottom to top and whose negative scale marks little-endian floats
+bool write_Pfm(const string& filepath, const float* data, int channels) {
+    FILE* file = fopen(filepath.c_str(), "wb");
+    if (!file)
+        return false;
+    const uint16_t one = 1;
+    bool littleEndian = *(const unsigned char*)&one == 1;
+    fprintf(file, "%s\n%u %u\n%s\n", channels == 3 ? "PF" : "Pf", width, height, littleEndian ? "-1.0" : "1.0");
+    for (int y = (int)height - 1; y >= 0; y--)
+        fwrite(data + (size_t)y * width * channels, sizeof(float), width * channels, file);
+    return fclose(file) == 0;
+}
+
+// Writes one output pass as <prefix>_<name>.pfm, or queues it as an 8-bit PNG where every
+// value is mapped by toByte
+bool write_Pass(const string& prefix, const string& name, const float* data, int channels, PngWriter* png,
+                const std::function<unsigned char(float)>& toByte) {
+    if (!png)
+        return write_Pfm(prefix + "_" + name + ".pfm", data, channels);
+    vector<unsigned char> bytes(width * height * channels);
+    std::transform(data, data + bytes.size(), bytes.begin(), toByte);
+    png->Write(prefix + "_" + name + ".png", std::move(bytes), width, height, channels);
+    return true;
+}
+
+// Writes every requested pass. In PNG, depth is scaled by the farthest hit, normals map
+// [-1, 1] to [0, 255], ids are stored as id + 1 (0 for background) and light is clamped.
+// PNG passes are only queued on png, which reports their writes.
+bool write_Aovs(const AovBuffers& aovs, const string& prefix, PngWriter* png) {
+    auto unit = [](float value) { return (unsigned char)(glm::clamp(value, 0.0f, 1.0f) * 255); };
+    bool written = true;
+    if (!aovs.depth.empty()) {
+        float farthest = std::max(*std::max_element(aovs.depth.begin(), aovs.depth.end()), 1e-6f);
+        written &= write_Pass(prefix, "depth", aovs.depth.data(), 1, png, [&](float depth) { return unit(depth / farthest); });
+    }
+    if (!aovs.normal.empty())
+        written &= write_Pass(prefix, "normal", &aovs.normal[0].x, 3, png, [&](float n) { return unit(n * 0.5f + 0.5f); });
+    if (!aovs.objectId.empty()) {
+        vector<float> ids(aovs.objectId.begin(), aovs.objectId.end());
+        written &= write_Pass(prefix, "id", ids.data(), 1, png, [](float id) { return (unsigned char)glm::clamp(id + 1, 0.0f, 255.0f); });
+    }
+    if (!aovs.direct.empty())
+        written &= write_Pass(prefix, "direct", &aovs.direct[0].x, 3, png, unit);
+    if (!aovs.reflected.empty())
+        written &= write_Pass(prefix, "reflected", &aovs.reflected[0].x, 3, png, unit);
+    return written;
+}
+
+// File of one scene of a batch render: "out.png" and "res/Scenes/scene2.txt" give "out_scene2.png"
+string batch_Output(string outputFile, const string& sceneFile) {
+    if (outputFile.size() > 4 && outputFile.compare(outputFile.size() - 4, 4, ".png") == 0)
+        outputFile.resize(outputFile.size() - 4);
+    string name = sceneFile.substr(sceneFile.find_last_of("/\\") + 1);
+    return outputFile + "_" + name.substr(0, name.find_last_of('.')) + ".png";
+}
+
 int main(int argc, char* argv[]) {
+    string sceneFile = "res/Scenes/scene1.txt";
+    vector<string> sceneFiles;  // every scene named on the command line
+    string outputFile;
+    string referenceFile;
+    bool progressive = false;
+    bool interactive = false;
+    bool temporal = false;
+    bool sequence = false;
+    int sequenceFrames = 0;
+    int fps = 24;
+    VideoFormat videoFormat = Y4M_VIDEO;
+    AovBuffers aovs;
+    bool aovPng = false;
+    string aovPrefix;
+    double frameMs = 33.0;
+    double budgetMs = 0;
+    bool determinismCheck = false;
+    bool replicateScene = false;
+    bool numaBenchmark = false;
+    bool autotuneSettings = false;
+    bool crop = false;
+    string mergeFile;
+    PngCompression pngCompression = PNG_DEFAULT;
+    vector<string> relightFiles;  // same eye and objects, other lights
+    vector<string> editFiles;     // same eye and lights, edited objects
+    std::set<string> givenOptions;  // options named on the command line win over tuned settings
+    RenderSettings settings;
+
+    for (int a = 1; a < argc; a++) {
+        string arg = argv[a];
+        givenOptions.insert(arg);
+        if (arg == "--wavefront")
+            settings.wavefront = true;
+        else if (arg == "--sort-secondary")
+            settings.sortSecondary = true;
+        else if (arg == "--threads" && a + 1 < argc)
+            settings.threads = atoi(argv[++a]);
+        else if (arg == "--packet" && a + 1 < argc)
+            settings.packetSize = glm::max(0, atoi(argv[++a]));
+        else if (arg == "--raster")
+            settings.rasterPrimary = true;
+        else if (arg == "--tile" && a + 1 < argc)
+            settings.tileSize = glm::max(1, atoi(argv[++a]));
+        else if (arg == "--aa" && a + 1 < argc)
+            settings.aaMaxSamples = glm::max(1, atoi(argv[++a]));
+        else if (arg == "--aa-threshold" && a + 1 < argc)
+            settings.aaThreshold = atof(argv[++a]);
+        else if (arg == "--sampler" && a + 1 < argc) {
+            if (!Sampler::ParseSequence(argv[++a], settings.sampleSequence))
+                std::cerr << "Unknown sampler " << argv[a] << ", using sobol" << std::endl;
+        }
+        else if (arg == "--denoise" && a + 1 < argc)
+            settings.denoisePasses = glm::max(0, atoi(argv[++a]));
+        else if (arg == "--reference" && a + 1 < argc)
+            referenceFile = argv[++a];
+        else if (arg == "--depth" && a + 1 < argc)
+            settings.maxDepth = glm::max(0, atoi(argv[++a]));
+        else if (arg == "--no-shadows")
+            settings.shadows = false;
+        else if (arg == "--budget" && a + 1 < argc)
+            budgetMs = atof(argv[++a]);
+        else if (arg == "--progressive")
+            progressive = true;
+        else if (arg == "--interactive")
+            interactive = true;
+        else if (arg == "--temporal")
+            temporal = true;
+        else if (arg == "--frame-ms" && a + 1 < argc)
+            frameMs = glm::max(1.0, atof(argv[++a]));
+        else if (arg == "--checkpoint" && a + 1 < argc)
+            settings.checkpointFile = argv[++a];
+        else if (arg == "--checkpoint-interval" && a + 1 < argc)
+            settings.checkpointInterval = glm::max(0.0, atof(argv[++a]));
+        else if (arg == "--resume")
+            settings.resume = true;
+        else if (arg == "--numa")
+            settings.numa = true;
+        else if (arg == "--numa-nodes" && a + 1 < argc)
+            settings.numaNodes = glm::max(0, atoi(argv[++a]));
+        else if (arg == "--numa-replicate")
+            replicateScene = true;
+        else if (arg == "--numa-benchmark")
+            numaBenchmark = true;
+        else if (arg == "--autotune")
+            autotuneSettings = true;
+        else if (arg == "--no-cost-schedule")
+            settings.costSchedule = false;
+        else if (arg == "--determinism-check")
+            determinismCheck = true;
+        else if (arg == "--region" && a + 1 < argc) {
+            int x, y, w, h;
+            if (sscanf(argv[++a], "%d,%d,%d,%d", &x, &y, &w, &h) != 4) {
+                std::cerr << "--region expects x,y,width,height, got " << argv[a] << std::endl;
+                return 1;
+            }
+            Tile region = { glm::max(x, 0), glm::max(y, 0), glm::min(x + w, (int)width), glm::min(y + h, (int)height) };
+            if (region.x0 >= region.x1 || region.y0 >= region.y1) {
+                std::cerr << "Region " << argv[a] << " is outside the " << width << "x" << height << " frame" << std::endl;
+                return 1;
+            }
+            settings.regions.push_back(region);
+        }
+        else if (arg == "--relight" && a + 1 < argc)
+            relightFiles.push_back(argv[++a]);
+        else if (arg == "--edit" && a + 1 < argc)
+            editFiles.push_back(argv[++a]);
+        else if (arg == "--crop")
+            crop = true;
+        else if (arg == "--merge" && a + 1 < argc)
+            mergeFile = argv[++a];
+        else if (arg == "--aov" && a + 1 < argc) {
+            if (!request_Aovs(aovs, argv[++a])) {
+                std::cerr << "--aov expects a comma-separated list of depth, normal, id, direct and reflected, got " << argv[a] << std::endl;
+                return 1;
+            }
+            settings.aovs = &aovs;
+        }
+        else if (arg == "--aov-format" && a + 1 < argc) {
+            string format = argv[++a];
+            if (format != "pfm" && format != "png") {
+                std::cerr << "--aov-format expects pfm or png, got " << format << std::endl;
+                return 1;
+            }
+            aovPng = format == "png";
+        }
+        else if (arg == "--aov-prefix" && a + 1 < argc)
+            aovPrefix = argv[++a];
+        else if (arg == "--sequence")
+            sequence = true;
+        else if (arg == "--frames" && a + 1 < argc)
+            sequenceFrames = glm::max(0, atoi(argv[++a]));
+        else if (arg == "--fps" && a + 1 < argc)
+            fps = glm::max(1, atoi(argv[++a]));
+        else if (arg == "--video" && a + 1 < argc) {
+            string format = argv[++a];
+            if (format != "y4m" && format != "rgb") {
+                std::cerr << "--video expects y4m or rgb, got " << format << std::endl;
+                return 1;
+            }
+            videoFormat = format == "y4m" ? Y4M_VIDEO : RAW_RGB_VIDEO;
+        }
+        else if (arg == "--output" && a + 1 < argc)
+            outputFile = argv[++a];
+        else if (arg == "--png" && a + 1 < argc) {
+            string compression = argv[++a];
+            if (compression != "store" && compression != "fast" && compression != "default") {
+                std::cerr << "--png expects store, fast or default, got " << compression << std::endl;
+                return 1;
+            }
+            pngCompression = compression == "store" ? PNG_STORE : compression == "fast" ? PNG_FAST : PNG_DEFAULT;
+        }
+        else {
+            sceneFile = arg;
+            sceneFiles.push_back(arg);
+        }
+    }
+
+    // stdout carries the video of a sequence, so everything else is logged to stderr
+    std::streambuf* coutBuffer = std::cout.rdbuf();
+    if (sequence)
+        std::cout.rdbuf(std::cerr.rdbuf());
+
+    // same scenes at several worker counts must give the same pixels
+    if (determinismCheck) {
+        if (sceneFiles.empty())
+            sceneFiles = bundled_Scenes();
+        int failures = determinism_Check(sceneFiles, settings);
+        std::cout << sceneFiles.size() - failures << " of " << sceneFiles.size() << " scenes are deterministic" << std::endl;
+        return failures > 0 ? 1 : 0;
+    }
+
     Reader* r = new Reader();
-    r->parser("res/Scenes/scene1.txt");
-    unsigned char* image = rendering(r);
-    display_Image(image);
+    r->parser(sceneFile);
+
+    if (settings.resume && settings.checkpointFile.empty()) {
+        std::cerr << "--resume needs a --checkpoint file" << std::endl;
+        return 1;
+    }
+    if (!settings.regions.empty() && (progressive || budgetMs > 0)) {
+        std::cerr << "--region cannot be combined with --progressive or --budget" << std::endl;
+        return 1;
+    }
+    if (!relightFiles.empty() && !settings.checkpointFile.empty()) {
+        std::cerr << "--relight cannot be combined with --checkpoint" << std::endl;
+        return 1;
+    }
+    if (interactive && (!outputFile.empty() || progressive || budgetMs > 0 || !settings.checkpointFile.empty() ||
+                        !settings.regions.empty() || !relightFiles.empty() || !editFiles.empty())) {
+        std::cerr << "--interactive cannot be combined with --output, --progressive, --budget, --checkpoint, --region, --relight or --edit" << std::endl;
+        return 1;
+    }
+    if (!editFiles.empty() && (progressive || budgetMs > 0 || !settings.checkpointFile.empty() ||
+                               !settings.regions.empty() || !relightFiles.empty())) {
+        std::cerr << "--edit cannot be combined with --progressive, --budget, --checkpoint, --region or --relight" << std::endl;
+        return 1;
+    }
+    if (settings.aovs && (progressive || budgetMs > 0 || interactive || !settings.checkpointFile.empty() ||
+                          !relightFiles.empty() || !editFiles.empty())) {
+        std::cerr << "--aov cannot be combined with --progressive, --budget, --interactive, --checkpoint, --relight or --edit" << std::endl;
+        return 1;
+    }
+    if (sequence && (!outputFile.empty() || progressive || budgetMs > 0 || interactive || !settings.checkpointFile.empty() ||
+                     !relightFiles.empty() || !editFiles.empty() || settings.aovs)) {
+        std::cerr << "--sequence cannot be combined with --output, --progressive, --budget, --interactive, --checkpoint, --relight, --edit or --aov" << std::endl;
+        return 1;
+    }
+    if ((crop || !mergeFile.empty()) && settings.regions.empty()) {
+        std::cerr << "--crop and --merge need at least one --region" << std::endl;
+        return 1;
+    }
+    bool batch = sceneFiles.size() > 1 && !outputFile.empty();
+    if (batch && (progressive || budgetMs > 0 || !settings.checkpointFile.empty() || !settings.regions.empty() ||
+                  !relightFiles.empty() || !editFiles.empty() || settings.aovs || !referenceFile.empty() || replicateScene)) {
+        std::cerr << "Several scenes with --output cannot be combined with --progressive, --budget, --checkpoint, --region, --relight, --edit, --aov, --reference or --numa-replicate" << std::endl;
+        return 1;
+    }
+
+    // PNG files are encoded on a background thread while the next work goes on; every exit waits for them
+    PngWriter pngWriter(pngCompression, settings.threads, [](const PngWritten& written) {
+        if (written.Written)
+            std::cout << "Wrote " << written.Filepath << " (" << written.Bytes / 1024.0 << " KiB) in " << written.EncodeMs << " ms" << std::endl;
+        else
+            std::cerr << "Cannot write " << written.Filepath << std::endl;
+    });
+
+    // tuned settings are keyed by machine and scene; none of them changes the pixels
+    TuningCache tuningCache(TUNING_CACHE_FILE);
+    string tuningKey = TuningCache::MachineKey() + " / " + hash_String(scene_Fingerprint(r));
+    TunedSettings tuned;
+    if (autotuneSettings) {
+        settings = autotune(r, settings);
+        if (!tuningCache.Store(tuningKey, tuned_Settings(settings)))
+            std::cerr << "Warning: cannot write " << tuningCache.GetFilepath() << std::endl;
+    }
+    else if (tuningCache.Load(tuningKey, tuned)) {
+        if (!givenOptions.count("--tile"))
+            settings.tileSize = tuned.TileSize;
+        if (!givenOptions.count("--packet"))
+            settings.packetSize = tuned.PacketSize;
+        if (!givenOptions.count("--threads"))
+            settings.threads = tuned.Threads;
+        if (!givenOptions.count("--wavefront") && !givenOptions.count("--sort-secondary")) {
+            settings.wavefront = tuned.Wavefront;
+            settings.sortSecondary = tuned.SortSecondary;
+        }
+        std::cout << "Tuned settings from " << tuningCache.GetFilepath() << ": " << describe_Tuning(settings) << std::endl;
+    }
+
+    if (numaBenchmark) {
+        numa_Benchmark(r, sceneFile, settings, replicateScene);
+        return 0;
+    }
+
+    // render the scenes one after another, each one's PNG encoding while the next one renders
+    if (batch) {
+        for (const string& file : sceneFiles) {
+            Reader scene;
+            scene.parser(file);
+            auto batchStart = std::chrono::steady_clock::now();
+            unsigned char* image = rendering(&scene, settings);
+            double batchMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batchStart).count();
+            std::cout << "Rendered " << file << " in " << batchMs << " ms, image hash " << hash_String(image_Hash(image)) << std::endl;
+            pngWriter.Write(batch_Output(outputFile, file), vector<unsigned char>(image, image + width * height * 4), width, height, 4);
+            delete[] image;
+        }
+        return pngWriter.Wait() ? 0 : 1;
+    }
+
+    vector<Reader*> nodeScenes;
+    if (settings.numa && replicateScene) {
+        nodeScenes = replicate_Scene(sceneFile, settings);
+        settings.nodeScenes = &nodeScenes;
+    }
+
+    // fly through the scene: the camera moves the eye, frames follow at a resolution that keeps up
+    if (interactive) {
+        FlyThrough fly;
+        fly.eye = r->eye->getCoordinates();
+        fly.targetMs = frameMs;
+        fly.temporal = temporal;
+        vector<unsigned char> blank(width * height * 4, 0);
+        std::thread renderer(render_Interactive, r, settings, &fly);
+        display_Image(blank.data(), nullptr, &fly);
+        stop_Flying(&fly);
+        renderer.join();
+        return 0;
+    }
+
+    // render the keyframed frames and stream them to stdout for an encoder
+    if (sequence) {
+#if defined(_WIN32) || defined(_WIN64)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        int frames = sequenceFrames > 0 ? sequenceFrames : sequence_Length(r);
+        bool streamed = render_Sequence(r, settings, frames, fps, videoFormat, stdout, std::cerr);
+        if (!streamed)
+            std::cerr << "Cannot write the video to stdout" << std::endl;
+        std::cout.rdbuf(coutBuffer);
+        return streamed ? 0 : 1;
+    }
+
+    // show passes as they finish instead of waiting for the whole frame
+    if (progressive && outputFile.empty()) {
+        PreviewFrame preview;
+        vector<unsigned char> blank(width * height * 4, 0);
+        std::thread renderer(render_Progressive, r, settings, &preview);
+        display_Image(blank.data(), &preview);
+        preview.cancel = true;
+        renderer.join();
+        return 0;
+    }
+
+    // best image that fits the wall-clock budget
+    if (budgetMs > 0) {
+        BudgetResult result = render_Budgeted(r, settings, budgetMs);
+        std::cout << "Budget " << budgetMs << " ms: ";
+        if (result.level >= 0)
+            std::cout << "reached level " << result.level << " (" << QUALITY_LEVELS[result.level].name << ")";
+        else
+            std::cout << "no quality level finished";
+        std::cout << " in " << result.elapsedMs << " ms" << std::endl;
+
+        if (!outputFile.empty())
+            pngWriter.Write(outputFile, std::move(result.image), width, height, 4);
+        else
+            display_Image(result.image.data());
+        return pngWriter.Wait() ? 0 : 1;
+    }
+
+    GBuffer gbuffer;
+    if (!relightFiles.empty())
+        settings.gbuffer = &gbuffer;
+    TouchMap touches;
+    if (!editFiles.empty())
+        settings.touches = &touches;
+
+    RenderStats stats;
+    auto start = std::chrono::steady_clock::now();
+    unsigned char* image = rendering(r, settings, &stats);
+    auto end = std::chrono::steady_clock::now();
+    double renderMs = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << "Rendered in " << renderMs << " ms" << std::endl;
+    std::cout << "Average samples per pixel: " << (double)stats.samples / stats.tracedPixels << std::endl;
+    std::cout << "Image hash: " << hash_String(image_Hash(image)) << std::endl;
+    if (stats.scheduledTiles > 0) {
+        std::cout << "Cost probe: " << stats.probeNanos / 1e6 << " ms, "
+                  << stats.scheduledTiles << " tiles after splitting" << std::endl;
+    }
+    if (!referenceFile.empty()) {
+        int referenceWidth, referenceHeight, components;
+        unsigned char* reference = stbi_load(referenceFile.c_str(), &referenceWidth, &referenceHeight, &components, 4);
+        if (reference && referenceWidth == (int)width && referenceHeight == (int)height)
+            std::cout << "PSNR against " << referenceFile << ": " << Denoiser::PSNR(image, reference, width * height) << " dB" << std::endl;
+        else
+            std::cerr << "Cannot compare with reference " << referenceFile << std::endl;
+        stbi_image_free(reference);
+    }
+    // output passes of the same traversal, named after the image
+    if (settings.aovs) {
+        if (aovPrefix.empty()) {
+            aovPrefix = outputFile.empty() ? "aov" : outputFile;
+            if (aovPrefix.size() > 4 && aovPrefix.compare(aovPrefix.size() - 4, 4, ".png") == 0)
+                aovPrefix.resize(aovPrefix.size() - 4);
+        }
+        if (write_Aovs(aovs, aovPrefix, aovPng ? &pngWriter : nullptr))
+            std::cout << "Output passes (" << aov_Bytes(aovs) / (1024.0 * 1024.0) << " MiB) " << (aovPng ? "queued for " : "written to ") << aovPrefix << "_*." << (aovPng ? "png" : "pfm") << std::endl;
+        else
+            std::cerr << "Cannot write the output passes to " << aovPrefix << "_*" << std::endl;
+    }
+    if (settings.wavefront) {
+        std::cout << "Secondary rays: " << stats.secondaryRays
+                  << ", sort " << stats.sortNanos / 1e6 << " ms"
+                  << ", trace " << stats.secondaryTraceNanos / 1e6 << " ms" << std::endl;
+    }
+
+    // re-shade the G-buffer under the lights of every --relight scene; the last one is kept
+    if (!relightFiles.empty())
+        std::cout << "G-buffer: " << gbuffer_Bytes(gbuffer) / (1024.0 * 1024.0) << " MiB" << std::endl;
+    for (const string& lightsFile : relightFiles) {
+        Reader lights;
+        lights.parser(lightsFile);
+        auto relightStart = std::chrono::steady_clock::now();
+        unsigned char* relit = relight(&lights, settings, gbuffer);
+        double relightMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - relightStart).count();
+        if (!relit) {
+            std::cerr << "Cannot relight with " << lightsFile << ": its eye or objects differ" << std::endl;
+            continue;
+        }
+        std::cout << "Relit with " << lightsFile << " in " << relightMs << " ms ("
+                  << 100.0 * relightMs / renderMs << "% of the render), image hash " << hash_String(image_Hash(relit)) << std::endl;
+        delete[] image;
+        image = relit;
+    }
+
+    // each --edit scene is rendered from the previous one, re-tracing only the cells it changes
+    if (!editFiles.empty())
+        std::cout << "Touch map: " << touch_Bytes(touches) / 1024.0 << " KiB" << std::endl;
+    Reader* edited = r;
+    for (const string& editFile : editFiles) {
+        Reader* next = new Reader();
+        next->parser(editFile);
+        RenderStats editStats;
+        auto editStart = std::chrono::steady_clock::now();
+        unsigned char* updated = render_Edits(edited, next, settings, touches, image, &editStats);
+        double editMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - editStart).count();
+        if (!updated) {
+            std::cerr << "Cannot edit into " << editFile << std::endl;
+            continue;
+        }
+        std::cout << "Edited into " << editFile << " in " << editMs << " ms (" << 100.0 * editMs / renderMs
+                  << "% of the render), traced " << 100.0 * editStats.tracedPixels / (width * height)
+                  << "% of the pixels, image hash " << hash_String(image_Hash(updated)) << std::endl;
+        delete[] image;
+        image = updated;
+        edited = next;
+    }
+
+    // re-rendered regions replace their pixels in an earlier image
+    if (!mergeFile.empty()) {
+        int baseWidth, baseHeight, components;
+        unsigned char* base = stbi_load(mergeFile.c_str(), &baseWidth, &baseHeight, &components, 4);
+        if (!base || baseWidth != (int)width || baseHeight != (int)height) {
+            std::cerr << "Cannot merge into " << mergeFile << ": not a " << width << "x" << height << " image" << std::endl;
+            stbi_image_free(base);
+            delete[] image;
+            return 1;
+        }
+        merge_Regions(image, settings.regions, base);
+        std::copy(base, base + width * height * 4, image);
+        stbi_image_free(base);
+    }
+
+    // write the image instead of opening a window
+    if (!outputFile.empty() && crop) {
+        Tile bounds = region_Bounds(settings.regions);
+        vector<unsigned char> cropped = crop_Image(image, bounds);
+        pngWriter.Write(outputFile, std::move(cropped), bounds.x1 - bounds.x0, bounds.y1 - bounds.y0, 4);
+    }
+    else if (!outputFile.empty())
+        pngWriter.Write(outputFile, vector<unsigned char>(image, image + width * height * 4), width, height, 4);
+    else
+        display_Image(image);
 
 
     delete[] image;
-    return 0;
-}
\ No newline at end of file
+    return pngWriter.Wait() ? 0 : 1;
+}